@@ -0,0 +1,234 @@
+// Headless benchmark of the physics core: runs update() as fast as possible
+// for each requested particle count and prints throughput.
+//
+//   bench [-s steps] [-t threads] [-b brute|grid|verlet|sweep|bvh[,...]]
+//         [-k skin] [-i scalar|simd128|avx2|avx512[,...]] [-p float|double]
+//         [-e step|event]
+//         [-T] [-r reorder_every] [-w world_width] [-a aspect]
+//         [-m count:radius] [n ...]
+//
+// Without -w the world is scaled with n to keep the app's default density;
+// -a makes it aspect times wider than high at the same area. Several
+// broadphases separated by commas are run one after another on each count,
+// and so are several isas, skipping any this machine cannot run.
+// -m gives the first count particles a bigger radius, for size mixtures.
+// Both precisions run from the same initial state unless -p picks one; the
+// energy drift column is the relative change in kinetic energy over the
+// run (with the BVH's area masses, so -m mixtures stay comparable), and
+// with both a summary compares float against double. -T adds a
+// per-phase timing table after each run. With Verlet lists each row is
+// followed by how often they were rebuilt and how long they were.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+#include "sim.hpp"
+
+namespace chrono = std::chrono;
+
+// in Broadphase order
+constexpr std::string_view broadphase_names[] = {
+    "brute", "grid", "verlet", "sweep", "bvh"};
+
+int big_count = 0;
+double big_radius = 0;
+
+struct Result {
+  double secs;
+  std::uint64_t pair_tests;
+  double drift;
+  std::uint64_t verlet_builds;
+  double verlet_neighbours; // per particle, at the last build
+};
+
+template<class T>
+Result run(int n, int steps) {
+  constexpr double max_speed = .03;
+  auto sim = Sim<T>{};
+  sim.randomize(n, max_speed, 12345);
+  sim.enlarge(big_count, big_radius);
+  sim.update(); // warm up the grid buffers
+  sim.pair_tests = 0;
+  sim.verlet.builds = 0;
+  timing::clear();
+  auto const e0 = sim.kinetic_energy();
+
+  auto const start = chrono::steady_clock::now();
+  for(int s = 0; s < steps; ++s) sim.update();
+  auto const secs =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  return {secs,
+          sim.pair_tests,
+          (sim.kinetic_energy() - e0) / e0,
+          sim.verlet.builds,
+          double(sim.verlet.nbrs.size()) / n};
+}
+
+int main(int argc, char** argv) {
+  int steps = 200;
+  int fixed_width = 0;
+  double aspect = 1;
+  std::vector<Broadphase> broadphases;
+  std::vector<simd::Isa> isas;
+  bool run_float = true, run_double = true;
+  std::vector<int> counts;
+  for(int a = 1; a < argc; ++a) {
+    auto const arg = std::string_view{argv[a]};
+    auto const next = [&] {
+      if(a + 1 >= argc) {
+        std::fprintf(stderr, "missing value for %s\n", argv[a]);
+        std::exit(1);
+      }
+      return std::string_view{argv[++a]};
+    };
+    if(arg == "-s")
+      steps = std::atoi(next().data());
+    else if(arg == "-t")
+      num_threads = std::max(1, std::atoi(next().data()));
+    else if(arg == "-i") {
+      auto list = next();
+      while(!list.empty()) {
+        auto const i = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(list.size(), i.size() + 1));
+        auto want = simd::Isa::scalar;
+        while(i != simd::name(want))
+          if(want == simd::Isa::avx512) {
+            std::fprintf(
+                stderr, "unknown isa %.*s\n", int(i.size()), i.data());
+            return 1;
+          } else
+            want = simd::Isa(int(want) + 1);
+        if(simd::supported(want))
+          isas.push_back(want);
+        else
+          std::fprintf(stderr,
+                       "%.*s not supported here\n",
+                       int(i.size()),
+                       i.data());
+      }
+    } else if(arg == "-p") {
+      auto const p = next();
+      run_float = p == "float";
+      run_double = p == "double";
+      if(!run_float && !run_double) {
+        std::fprintf(stderr, "unknown precision %s\n", p.data());
+        return 1;
+      }
+    } else if(arg == "-e") {
+      auto const e = next();
+      if(e == "step")
+        engine = Engine::timestep;
+      else if(e == "event")
+        engine = Engine::event_driven;
+      else {
+        std::fprintf(stderr, "unknown engine %s\n", e.data());
+        return 1;
+      }
+    } else if(arg == "-T")
+      timing::enabled = true;
+    else if(arg == "-r")
+      reorder_every = std::max(0, std::atoi(next().data()));
+    else if(arg == "-k")
+      skin = std::atof(next().data());
+    else if(arg == "-w")
+      fixed_width = std::atoi(next().data());
+    else if(arg == "-m") {
+      auto const m = next();
+      if(std::sscanf(m.data(), "%d:%lf", &big_count, &big_radius) != 2) {
+        std::fprintf(stderr, "expected count:radius, not %s\n", m.data());
+        return 1;
+      }
+    } else if(arg == "-a")
+      aspect = std::max(1e-3, std::atof(next().data()));
+    else if(arg == "-b") {
+      auto list = next();
+      while(!list.empty()) {
+        auto const b = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(list.size(), b.size() + 1));
+        auto const known = std::find(
+            std::begin(broadphase_names), std::end(broadphase_names), b);
+        if(known == std::end(broadphase_names)) {
+          std::fprintf(stderr,
+                       "unknown broadphase %.*s\n",
+                       int(b.size()),
+                       b.data());
+          return 1;
+        }
+        broadphases.push_back(
+            Broadphase(known - std::begin(broadphase_names)));
+      }
+    } else
+      counts.push_back(std::atoi(arg.data()));
+  }
+  if(counts.empty()) counts = {400, 4000, 40000};
+  if(broadphases.empty()) broadphases = {broadphase};
+  if(isas.empty()) isas = {simd::isa};
+
+  constexpr int default_count = 400, default_width = 300;
+
+  std::printf("threads: %u, engine: %s\n",
+              num_threads,
+              engine == Engine::event_driven ? "event" : "step");
+  std::printf("%10s %7s %9s %10s %11s %8s %12s %14s %14s %14s\n",
+              "broadphase",
+              "isa",
+              "precision",
+              "particles",
+              "world",
+              "steps",
+              "steps/s",
+              "ns/part-step",
+              "pairs/step",
+              "energy drift");
+  for(auto const n : counts) {
+    auto const side = fixed_width ? fixed_width
+                                  : default_width
+                                        * std::sqrt(double(n) / default_count);
+    world_width = static_cast<int>(side * std::sqrt(aspect));
+    world_height = static_cast<int>(side / std::sqrt(aspect));
+    char world[32];
+    std::snprintf(world, sizeof world, "%dx%d", world_width, world_height);
+    for(auto const b : broadphases)
+      for(auto const i : isas) {
+        broadphase = b;
+        simd::isa = i;
+        auto const report = [&](char const* precision, Result const& r) {
+          std::printf(
+              "%10s %7s %9s %10d %11s %8d %12.1f %14.2f %14.0f %14.3e\n",
+              broadphase_names[int(broadphase)].data(),
+              simd::name(simd::isa),
+              precision,
+              n,
+              world,
+              steps,
+              steps / r.secs,
+              r.secs * 1e9 / (double(steps) * n),
+              double(r.pair_tests) / steps,
+              r.drift);
+          if(broadphase == Broadphase::verlet)
+            std::printf(
+                "%20s verlet: %llu builds, %.1f neighbours/particle\n",
+                "",
+                static_cast<unsigned long long>(r.verlet_builds),
+                r.verlet_neighbours);
+          if(timing::enabled) timing::report();
+        };
+        Result f{}, d{};
+        if(run_double) report("double", d = run<double>(n, steps));
+        if(run_float) report("float", f = run<float>(n, steps));
+        if(run_float && run_double)
+          std::printf("%20s float speedup %.2fx, drift difference %.3e\n",
+                      "",
+                      d.secs / f.secs,
+                      f.drift - d.drift);
+      }
+  }
+  return 0;
+}
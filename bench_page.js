@@ -0,0 +1,6 @@
+// Arguments for bench.html: the query string split on '&', e.g.
+// bench.html?-i&scalar,simd128&-p&float&40000. Without one the page compares
+// the scalar kernels against simd128 at the default counts.
+Module['arguments'] = location.search
+  ? location.search.slice(1).split('&').map(decodeURIComponent)
+  : ['-i', 'scalar,simd128'];
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "morton.hpp"
+#include "particle_store.hpp"
+#include "thread_pool.hpp"
+
+// Bounding volume hierarchy for particles of any size: an implicit complete
+// binary tree (node k has children 2k and 2k + 1) whose leaves hold up to
+// `leaf` particles. A build splits each node's particles at the median of
+// their longer extent; after that each step only refits the boxes
+// bottom-up, and the tree is rebuilt once the leaf boxes' total area has
+// grown by rebuild_growth. A big particle only widens the boxes on its
+// own path to the root, so one big particle among many small ones costs
+// little, unlike a grid whose cells must fit the biggest one.
+template<class T>
+class Bvh {
+ public:
+  static constexpr int leaf = 4;
+  static constexpr double rebuild_growth = 1.5;
+
+  struct Stats {
+    std::uint64_t builds = 0, refits = 0;
+  };
+  Stats stats;
+
+  void invalidate() { order_.clear(); }
+
+  // Brings the tree up to date with the particles' positions and radii;
+  // particle i reaches scale * radii[i] from its centre.
+  void update(ParticleStore<T> const& p,
+              std::span<T const> radii,
+              T scale,
+              double width,
+              double height,
+              ThreadPool& pool) {
+    scale_ = scale;
+    if(order_.size() != p.size()) return build(p, radii, width, height, pool);
+    refit(p, radii, pool);
+    ++stats.refits;
+    if(area_ > rebuild_growth * built_area_)
+      build(p, radii, width, height, pool);
+  }
+
+  // Calls f(i, j) once for every pair whose reaches overlap, in a fixed
+  // order; returns how many particle pairs were tested. Each leaf looks for
+  // the leaves at or after it that its box touches, in parallel; the calls
+  // are made afterwards, in leaf order.
+  template<class F>
+  std::uint64_t for_each_pair(ParticleStore<T> const& p,
+                              std::span<T const> radii,
+                              ThreadPool& pool,
+                              F&& f) {
+    auto const n = order_.size();
+    auto const x = p.x(), y = p.y();
+    auto const depth = std::bit_width(unsigned(leaves_)) - 1;
+    constexpr std::size_t grain = 256;
+    chunks_.resize((leaves_ + grain - 1) / grain);
+    for(auto& pairs : chunks_) pairs.clear();
+    std::atomic<std::uint64_t> tests{0};
+    // leaves [b, e) of one chunks_ entry
+    auto const find = [&](std::size_t b, std::size_t e) {
+      auto& pairs = chunks_[b / grain];
+      auto t = std::uint64_t{0};
+      auto const test = [&](std::size_t s, std::size_t u) {
+        auto const i = order_[s], j = order_[u];
+        auto const dx = x[i] - x[j], dy = y[i] - y[j];
+        auto const reach = scale_ * radii[i] + scale_ * radii[j];
+        ++t;
+        if(dx * dx + dy * dy <= reach * reach) pairs.emplace_back(i, j);
+      };
+      int stack[64];
+      for(auto l = b; l < e; ++l) {
+        auto const first = l * leaf, last = std::min(first + leaf, n);
+        if(first >= last) break;
+        for(auto s = first; s < last; ++s)
+          for(auto u = s + 1; u < last; ++u) test(s, u);
+        auto const& q = boxes_[leaves_ + l];
+        int top = 0;
+        stack[top++] = 1;
+        while(top) {
+          auto const node = stack[--top];
+          // skip subtrees that only hold earlier leaves
+          auto const below = depth + 1 - std::bit_width(unsigned(node));
+          auto const after = ((std::size_t(node) + 1) << below) - leaves_;
+          if(after <= l + 1 || !overlaps(boxes_[node], q)) continue;
+          if(node < leaves_) {
+            stack[top++] = 2 * node + 1;
+            stack[top++] = 2 * node;
+            continue;
+          }
+          auto const m = std::size_t(node - leaves_) * leaf;
+          for(auto s = first; s < last; ++s)
+            for(auto u = m; u < std::min(m + leaf, n); ++u) test(s, u);
+        }
+      }
+      tests += t;
+    };
+    // a single-threaded pool hands out the whole range at once
+    pool.parallel_for(leaves_, grain, [&](std::size_t b, std::size_t e) {
+      for(auto c = b; c < e; c = (c / grain + 1) * grain)
+        find(c, std::min(e, (c / grain + 1) * grain));
+    });
+    for(auto const& pairs : chunks_)
+      for(auto const& [i, j] : pairs) f(i, j);
+    return tests;
+  }
+
+ private:
+  struct Box {
+    T x0, y0, x1, y1;
+  };
+
+  static bool overlaps(Box const& a, Box const& b) {
+    return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+  }
+  static Box merge(Box const& a, Box const& b) {
+    return {std::min(a.x0, b.x0),
+            std::min(a.y0, b.y0),
+            std::max(a.x1, b.x1),
+            std::max(a.y1, b.y1)};
+  }
+
+  void build(ParticleStore<T> const& p,
+             std::span<T const> radii,
+             double width,
+             double height,
+             ThreadPool& pool) {
+    // Morton order first, so the median splits mostly find their halves
+    // already in place
+    auto const order = sorter_.order(p.x(), p.y(), width, height);
+    order_.assign(order.begin(), order.end());
+    auto const n = order_.size();
+    auto const used = static_cast<int>((n + leaf - 1) / leaf);
+    leaves_ = 1;
+    while(leaves_ < used) leaves_ *= 2;
+    boxes_.resize(2 * leaves_);
+    auto const x = p.x(), y = p.y();
+    // node k covers slots [b, e) of the padded leaf range; the slots of one
+    // level are disjoint, so its nodes split in parallel
+    for(int first = 1; first < leaves_; first *= 2) {
+      auto const span = std::size_t(leaves_ / first) * leaf;
+      pool.parallel_for(first, 64, [&](std::size_t kb, std::size_t ke) {
+        for(auto k = kb; k < ke; ++k) {
+          auto const b = std::min(k * span, n), e = std::min(b + span, n);
+          auto const mid = std::min(k * span + span / 2, n);
+          if(mid <= b || mid >= e) continue;
+          auto lo_x = x[order_[b]], hi_x = lo_x, lo_y = y[order_[b]],
+               hi_y = lo_y;
+          for(auto s = b; s < e; ++s) {
+            lo_x = std::min(lo_x, x[order_[s]]);
+            hi_x = std::max(hi_x, x[order_[s]]);
+            lo_y = std::min(lo_y, y[order_[s]]);
+            hi_y = std::max(hi_y, y[order_[s]]);
+          }
+          auto const along = hi_x - lo_x >= hi_y - lo_y ? x : y;
+          std::nth_element(order_.begin() + b,
+                           order_.begin() + mid,
+                           order_.begin() + e,
+                           [&](int i, int j) { return along[i] < along[j]; });
+        }
+      });
+    }
+    refit(p, radii, pool);
+    built_area_ = area_;
+    ++stats.builds;
+  }
+
+  // recomputes every box from the particles, bottom-up
+  void refit(ParticleStore<T> const& p,
+             std::span<T const> radii,
+             ThreadPool& pool) {
+    auto const n = order_.size();
+    auto const x = p.x(), y = p.y();
+    constexpr auto inf = std::numeric_limits<T>::infinity();
+    pool.parallel_for(leaves_, 1024, [&](std::size_t b, std::size_t e) {
+      for(auto l = b; l < e; ++l) {
+        Box box{inf, inf, -inf, -inf};
+        for(auto s = l * leaf; s < std::min(l * leaf + leaf, n); ++s) {
+          auto const i = order_[s];
+          auto const r = scale_ * radii[i];
+          box = merge(box, {x[i] - r, y[i] - r, x[i] + r, y[i] + r});
+        }
+        boxes_[leaves_ + l] = box;
+      }
+    });
+    area_ = 0;
+    for(auto l = leaves_; l < 2 * leaves_; ++l)
+      if(boxes_[l].x0 <= boxes_[l].x1)
+        area_ += double(boxes_[l].x1 - boxes_[l].x0)
+                 * (boxes_[l].y1 - boxes_[l].y0);
+    for(auto k = leaves_ - 1; k > 0; --k)
+      boxes_[k] = merge(boxes_[2 * k], boxes_[2 * k + 1]);
+  }
+
+  morton::Sorter sorter_;
+  std::vector<int> order_; // particles by leaf
+  std::vector<Box> boxes_; // boxes_[1] is the root, leaves from leaves_
+  int leaves_ = 1;
+  T scale_ = 1;
+  double area_ = 0, built_area_ = 0;
+  std::vector<std::vector<std::pair<int, int>>> chunks_; // pairs found
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sim.hpp"
+
+// Startup configuration. Options come from an optional file of `key = value`
+// lines (# starts a comment) named by --config, then from --key=value or
+// --key value flags, which win over the file. Everything is parsed once,
+// before the simulation is set up.
+namespace config {
+
+class Options {
+ public:
+  // set returns false if the value is invalid
+  using Setter = std::function<bool(std::string_view)>;
+
+  void add(std::string name, std::string help, Setter set) {
+    options_.push_back({std::move(name), std::move(help), std::move(set)});
+  }
+
+  // Parses all of s into v, leaving v alone if it is not a V: integers
+  // out of V's range, and so a sign on an unsigned V, are rejected.
+  template<class V>
+  static bool read(std::string_view s, V& v) {
+    if constexpr(std::is_same_v<V, std::string>) {
+      v = s;
+      return true;
+    } else if constexpr(std::is_floating_point_v<V>) {
+      // not every standard library has from_chars for floating point yet
+      auto const str = std::string{s};
+      char* end = nullptr;
+      auto const d = std::strtod(str.c_str(), &end);
+      if(str.empty() || *end != '\0' || !std::isfinite(d)
+         || std::abs(d) > std::numeric_limits<V>::max())
+        return false;
+      v = static_cast<V>(d);
+      return true;
+    } else {
+      V parsed{};
+      auto const [end, error] =
+          std::from_chars(s.data(), s.data() + s.size(), parsed);
+      if(error != std::errc{} || end != s.data() + s.size()) return false;
+      v = parsed;
+      return true;
+    }
+  }
+
+  template<class V>
+  void value(std::string name, std::string help, V& v) {
+    add(std::move(name), std::move(help), [&v](std::string_view s) {
+      return read(s, v);
+    });
+  }
+
+  template<class E>
+  void choice(std::string name,
+              E& e,
+              std::initializer_list<std::pair<char const*, E>> names) {
+    std::string help;
+    for(auto const& [n, _] : names) {
+      if(!help.empty()) help += '|';
+      help += n;
+    }
+    add(std::move(name),
+        std::move(help),
+        [&e, names = std::vector(names)](std::string_view s) {
+          for(auto const& [n, v] : names)
+            if(s == n) return e = v, true;
+          return false;
+        });
+  }
+
+  // Reads --config first, then the other flags; false after --help or an
+  // error, which has been reported.
+  bool parse(int argc, char** argv) {
+    std::vector<std::pair<std::string_view, std::string_view>> flags;
+    for(int a = 1; a < argc; ++a) {
+      auto arg = std::string_view{argv[a]};
+      if(arg == "--help" || arg == "-h") {
+        usage(argv[0]);
+        return false;
+      }
+      if(!arg.starts_with("--")) {
+        std::fprintf(stderr, "unexpected argument %s\n", argv[a]);
+        return false;
+      }
+      arg.remove_prefix(2);
+      auto const eq = arg.find('=');
+      if(eq != arg.npos)
+        flags.emplace_back(arg.substr(0, eq), arg.substr(eq + 1));
+      else if(a + 1 < argc)
+        flags.emplace_back(arg, argv[++a]);
+      else {
+        std::fprintf(stderr, "missing value for --%s\n", arg.data());
+        return false;
+      }
+    }
+    for(auto const& [name, value] : flags)
+      if(name == "config" && !load(std::string{value})) return false;
+    for(auto const& [name, value] : flags)
+      if(name != "config" && !set(name, value, "command line")) return false;
+    return true;
+  }
+
+  bool load(std::string const& path) {
+    std::ifstream in{path};
+    if(!in) {
+      std::fprintf(stderr, "cannot read %s\n", path.c_str());
+      return false;
+    }
+    std::string line;
+    for(int number = 1; std::getline(in, line); ++number) {
+      auto const trim = [](std::string_view s) {
+        auto const b = s.find_first_not_of(" \t\r");
+        if(b == s.npos) return std::string_view{};
+        return s.substr(b, s.find_last_not_of(" \t\r") - b + 1);
+      };
+      auto text = std::string_view{line};
+      text = trim(text.substr(0, text.find('#')));
+      if(text.empty()) continue;
+      auto const eq = text.find('=');
+      auto const where = path + ":" + std::to_string(number);
+      if(eq == text.npos) {
+        std::fprintf(stderr, "%s: expected key = value\n", where.c_str());
+        return false;
+      }
+      if(!set(trim(text.substr(0, eq)), trim(text.substr(eq + 1)), where))
+        return false;
+    }
+    return true;
+  }
+
+  void usage(char const* program) const {
+    std::fprintf(
+        stderr, "usage: %s [--config file] [--key value ...]\n", program);
+    for(auto const& o : options_)
+      std::fprintf(stderr, "  --%-18s %s\n", o.name.c_str(), o.help.c_str());
+  }
+
+ private:
+  bool set(std::string_view name,
+           std::string_view value,
+           std::string_view where) {
+    for(auto const& o : options_)
+      if(o.name == name) {
+        if(o.set(value)) return true;
+        std::fprintf(stderr,
+                     "%.*s: bad value '%.*s' for %.*s (%s)\n",
+                     int(where.size()),
+                     where.data(),
+                     int(value.size()),
+                     value.data(),
+                     int(name.size()),
+                     name.data(),
+                     o.help.c_str());
+        return false;
+      }
+    std::fprintf(stderr,
+                 "%.*s: unknown option %.*s\n",
+                 int(where.size()),
+                 where.data(),
+                 int(name.size()),
+                 name.data());
+    return false;
+  }
+
+  struct Option {
+    std::string name, help;
+    Setter set;
+  };
+  std::vector<Option> options_;
+};
+
+// The shared physics parameters in sim.hpp. Options only stores what was
+// given; apply() fills in the derived defaults afterwards.
+struct World {
+  std::optional<int> height;      // defaults to the width
+  std::optional<double> col_rad;  // defaults to 5 * radius
+  int update_step_ms = static_cast<int>(update_step.count());
+
+  void add_to(Options& o) {
+    o.value("radius", "particle radius in pixels", radius);
+    o.value("world-width", "world width in pixels", world_width);
+    o.add("world-height", "world height in pixels (default: width)",
+          [this](std::string_view s) {
+            int h = 0;
+            return Options::read(s, h) && h > 0 && (height = h, true);
+          });
+    o.value("update-step", "simulated ms per step", update_step_ms);
+    o.add("col-rad", "squared collision distance (default: 5 * radius)",
+          [this](std::string_view s) {
+            double c = 0;
+            return Options::read(s, c) && c > 0 && (col_rad = c, true);
+          });
+    o.choice("broadphase",
+             broadphase,
+             {{"brute", Broadphase::brute},
+              {"grid", Broadphase::grid},
+              {"verlet", Broadphase::verlet},
+              {"sweep", Broadphase::sweep},
+              {"bvh", Broadphase::bvh}});
+    o.value("skin", "Verlet list margin beyond the collision reach", skin);
+    o.choice("placement",
+             placement,
+             {{"lattice", Placement::lattice},
+              {"uniform", Placement::uniform}});
+    o.choice("engine",
+             engine,
+             {{"step", Engine::timestep}, {"event", Engine::event_driven}});
+    o.value("reorder-every",
+            "steps between Morton reorders of the particles, 0 for never",
+            reorder_every);
+    o.value("threads",
+            "worker threads including the caller, capped to what the build "
+            "allows",
+            num_threads);
+    o.add("isa",
+          "scalar|simd128|avx2|avx512, capped to what can run here",
+          [](std::string_view s) {
+            using simd::Isa;
+            for(auto i : {Isa::scalar, Isa::simd128, Isa::avx2, Isa::avx512})
+              if(s == simd::name(i)) {
+                simd::isa = simd::cap(i);
+                return true;
+              }
+            return false;
+          });
+  }
+
+  // false if the result makes no sense
+  bool apply() const {
+    world_height = height.value_or(world_width);
+    update_step = std::chrono::milliseconds{update_step_ms};
+    ::col_rad = col_rad.value_or(5 * radius);
+    num_threads = std::min(num_threads, max_threads);
+    if(radius <= 0 || world_width <= 2 * radius || world_height <= 2 * radius
+       || update_step_ms <= 0 || num_threads < 1 || skin < 0
+       || reorder_every < 0) {
+      std::fprintf(stderr, "invalid world: radius %g, %d x %d, step %d ms\n",
+                   radius, world_width, world_height, update_step_ms);
+      return false;
+    }
+    return true;
+  }
+};
+
+} // namespace config
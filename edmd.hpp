@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include "particle_store.hpp"
+
+// Event-driven dynamics for hard disks: instead of stepping everything by a
+// fixed dt and fixing overlaps afterwards, predict when each particle next
+// hits another particle, a wall, or the edge of its cell, and jump straight
+// from event to event.
+//
+// Positions are stored as of each particle's own time (time_[i]) and only
+// brought up to date when an event touches the particle; advance() syncs
+// everything at the end so the store reads like after a fixed step. Events
+// are never removed from the queue: every particle has a counter that is
+// bumped whenever its velocity changes, and an event whose counters no
+// longer match is stale and skipped when popped.
+template<class T>
+class EventDriven {
+ public:
+  struct Stats {
+    std::uint64_t collisions = 0, walls = 0, crossings = 0, stale = 0;
+    std::uint64_t predictions = 0; // pair collision times computed
+  };
+  Stats stats;
+
+  // disk diameter and the box the centres live in
+  EventDriven(double sigma, double lo_x, double hi_x, double lo_y, double hi_y)
+      : sigma2_{sigma * sigma}, lo_{lo_x, lo_y}, hi_{hi_x, hi_y} {
+    for(int a = 0; a < 2; ++a) {
+      // cells of at least sigma, so collision partners are in the 3x3 block
+      n_[a] = std::max(1, static_cast<int>(hi_[a] / sigma));
+      size_[a] = hi_[a] / n_[a];
+    }
+  }
+
+  // Run every event up to t1, then bring all particles to t1. p must be in
+  // sync at t0, as left by the previous call or by the caller; the first
+  // call predicts everything from scratch.
+  void advance(ParticleStore<T>& p, double t0, double t1) {
+    if(!primed_ || queue_.size() > 8 * p.size() + 1024) reset(p, t0);
+    while(!queue_.empty() && queue_.top().t <= t1) {
+      auto const e = queue_.top();
+      queue_.pop();
+      if(count_[e.i] != e.ci || (e.j >= 0 && count_[e.j] != e.cj)) {
+        ++stats.stale;
+        continue;
+      }
+      switch(e.j) {
+        case wall_x:
+        case wall_y: bounce(p, e.i, e.j == wall_x ? 0 : 1, e.t); break;
+        case cross_x:
+        case cross_y: cross(p, e.i, e.j == cross_x ? 0 : 1, e.t); break;
+        default: collide(p, e.i, e.j, e.t);
+      }
+    }
+    for(int i = 0; i < static_cast<int>(p.size()); ++i) move(p, i, t1);
+  }
+
+ private:
+  enum Kind : int { wall_x = -1, wall_y = -2, cross_x = -3, cross_y = -4 };
+  struct Event {
+    double t;
+    int i, j; // j is the partner, or a Kind
+    std::uint32_t ci, cj;
+    bool operator>(Event const& e) const { return t > e.t; }
+  };
+  static constexpr double never = std::numeric_limits<double>::infinity();
+
+  T* pos(ParticleStore<T>& p, int a) { return (a ? p.y() : p.x()).data(); }
+  T* vel(ParticleStore<T>& p, int a) { return (a ? p.vy() : p.vx()).data(); }
+
+  int cell(int cx, int cy) const { return cy * n_[0] + cx; }
+  int coord(double x, int a) const {
+    return std::clamp(static_cast<int>(x / size_[a]), 0, n_[a] - 1);
+  }
+
+  void link(int i, int c) {
+    cell_[i] = c;
+    prev_[i] = -1;
+    next_[i] = head_[c];
+    if(head_[c] >= 0) prev_[head_[c]] = i;
+    head_[c] = i;
+  }
+  void unlink(int i) {
+    if(prev_[i] >= 0)
+      next_[prev_[i]] = next_[i];
+    else
+      head_[cell_[i]] = next_[i];
+    if(next_[i] >= 0) prev_[next_[i]] = prev_[i];
+  }
+
+  void reset(ParticleStore<T>& p, double t) {
+    auto const n = static_cast<int>(p.size());
+    time_.assign(n, t);
+    count_.assign(n, 0);
+    cell_.resize(n);
+    next_.resize(n);
+    prev_.resize(n);
+    head_.assign(n_[0] * n_[1], -1);
+    queue_ = {};
+    for(int i = 0; i < n; ++i)
+      link(i, cell(coord(p.x()[i], 0), coord(p.y()[i], 1)));
+    for(int i = 0; i < n; ++i) {
+      predict_walls(p, i);
+      predict_crossing(p, i);
+      predict_pairs(p, i, true);
+    }
+    primed_ = true;
+  }
+
+  void move(ParticleStore<T>& p, int i, double t) {
+    auto const dt = t - time_[i];
+    p.x()[i] = static_cast<T>(p.x()[i] + p.vx()[i] * dt);
+    p.y()[i] = static_cast<T>(p.y()[i] + p.vy()[i] * dt);
+    time_[i] = t;
+  }
+
+  void push(double t, int i, int j) {
+    queue_.push({t, i, j, count_[i], j >= 0 ? count_[j] : 0});
+  }
+
+  void predict_walls(ParticleStore<T>& p, int i) {
+    for(int a = 0; a < 2; ++a) {
+      auto const v = double(vel(p, a)[i]), x = double(pos(p, a)[i]);
+      if(v == 0) continue;
+      auto const dt = ((v > 0 ? hi_[a] : lo_[a]) - x) / v;
+      push(time_[i] + std::max(dt, 0.0), i, a ? wall_y : wall_x);
+    }
+  }
+
+  void predict_crossing(ParticleStore<T>& p, int i) {
+    auto best = never;
+    int axis = 0;
+    int const c[2] = {cell_[i] % n_[0], cell_[i] / n_[0]};
+    for(int a = 0; a < 2; ++a) {
+      auto const v = double(vel(p, a)[i]), x = double(pos(p, a)[i]);
+      if(v == 0 || c[a] + (v > 0 ? 1 : -1) < 0
+         || c[a] + (v > 0 ? 1 : -1) >= n_[a])
+        continue;
+      auto const edge = (c[a] + (v > 0 ? 1 : 0)) * size_[a];
+      auto const dt = std::max((edge - x) / v, 0.0);
+      if(dt < best) best = dt, axis = a;
+    }
+    if(best < never) push(time_[i] + best, i, axis ? cross_y : cross_x);
+  }
+
+  // Predicts collisions of i (which must be current) with everything in the
+  // surrounding 3x3 cells. At reset only pairs with j < i are pushed, so
+  // each pair is predicted once.
+  void predict_pairs(ParticleStore<T>& p, int i, bool lower_only = false) {
+    auto const t = time_[i];
+    int const cx = cell_[i] % n_[0], cy = cell_[i] / n_[0];
+    for(int y = std::max(cy - 1, 0); y <= std::min(cy + 1, n_[1] - 1); ++y)
+      for(int x = std::max(cx - 1, 0); x <= std::min(cx + 1, n_[0] - 1); ++x)
+        for(int j = head_[cell(x, y)]; j >= 0; j = next_[j]) {
+          if(j == i || (lower_only && j > i)) continue;
+          ++stats.predictions;
+          auto const dtj = t - time_[j];
+          auto const rx = double(p.x()[i]) - (p.x()[j] + p.vx()[j] * dtj);
+          auto const ry = double(p.y()[i]) - (p.y()[j] + p.vy()[j] * dtj);
+          auto const vx = double(p.vx()[i]) - p.vx()[j];
+          auto const vy = double(p.vy()[i]) - p.vy()[j];
+          auto const b = rx * vx + ry * vy;
+          if(b >= 0) continue; // moving apart
+          auto const r2 = rx * rx + ry * ry, v2 = vx * vx + vy * vy;
+          if(r2 <= sigma2_) { // overlapping already, e.g. from random placement
+            push(t, i, j);
+            continue;
+          }
+          auto const d = b * b - v2 * (r2 - sigma2_);
+          if(d >= 0) push(t + (-b - std::sqrt(d)) / v2, i, j);
+        }
+  }
+
+  void repredict(ParticleStore<T>& p, int i) {
+    ++count_[i];
+    predict_walls(p, i);
+    predict_crossing(p, i);
+    predict_pairs(p, i);
+  }
+
+  // elastic collision of equal masses: swap the normal velocity components
+  void collide(ParticleStore<T>& p, int i, int j, double t) {
+    ++stats.collisions;
+    move(p, i, t);
+    move(p, j, t);
+    auto const rx = double(p.x()[i]) - p.x()[j];
+    auto const ry = double(p.y()[i]) - p.y()[j];
+    auto const r = std::sqrt(rx * rx + ry * ry);
+    if(r > 0) {
+      auto const nx = rx / r, ny = ry / r;
+      auto const dv = (double(p.vx()[i]) - p.vx()[j]) * nx
+                      + (double(p.vy()[i]) - p.vy()[j]) * ny;
+      p.vx()[i] = static_cast<T>(p.vx()[i] - dv * nx);
+      p.vy()[i] = static_cast<T>(p.vy()[i] - dv * ny);
+      p.vx()[j] = static_cast<T>(p.vx()[j] + dv * nx);
+      p.vy()[j] = static_cast<T>(p.vy()[j] + dv * ny);
+    }
+    repredict(p, i);
+    repredict(p, j);
+  }
+
+  void bounce(ParticleStore<T>& p, int i, int a, double t) {
+    ++stats.walls;
+    move(p, i, t);
+    vel(p, a)[i] = -vel(p, a)[i];
+    pos(p, a)[i] =
+        static_cast<T>(std::clamp(double(pos(p, a)[i]), lo_[a], hi_[a]));
+    repredict(p, i);
+  }
+
+  // Entering a new cell brings new neighbours but leaves the particle's
+  // other predictions valid, so its counter is not bumped.
+  void cross(ParticleStore<T>& p, int i, int a, double t) {
+    ++stats.crossings;
+    move(p, i, t);
+    int c[2] = {cell_[i] % n_[0], cell_[i] / n_[0]};
+    c[a] += vel(p, a)[i] > 0 ? 1 : -1;
+    unlink(i);
+    link(i, cell(c[0], c[1]));
+    predict_crossing(p, i);
+    predict_pairs(p, i);
+  }
+
+  double sigma2_;
+  double lo_[2], hi_[2];
+  int n_[2];
+  double size_[2];
+  bool primed_ = false;
+
+  std::priority_queue<Event, std::vector<Event>, std::greater<>> queue_;
+  std::vector<double> time_;         // time each stored position refers to
+  std::vector<std::uint32_t> count_; // bumped when a particle's events go stale
+  std::vector<int> cell_, next_, prev_, head_; // per-cell linked lists
+};
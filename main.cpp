@@ -1,9 +1,29 @@
 #include <vector>
-#include <complex>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iterator>
+#include <thread>
+#include <span>
+#include <utility>
+#include <numbers>
+#include <optional>
 #include <random>
 #include <iostream>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "config.hpp"
+#include "scheduler.hpp"
+#include "sim.hpp"
+#include "snapshot.hpp"
+#include "trajectory.hpp"
+#include "triple_buffer.hpp"
 
 #include "sdl2raii/emscripten_glue.hpp"
 #include "sdl2raii/sdl.hpp"
@@ -18,115 +38,634 @@ struct finally {
 using namespace std::literals;
 namespace chrono = std::chrono;
 
-using fptype = double;
-using vec = std::complex<fptype>;
+Sim<fptype> sim;
 
-auto dot(vec const z, vec const w) { return z * conj(w); }
-auto wedge(vec const z, vec const w) {
-  return z.real() * w.imag() - z.imag() * w.real();
-}
+namespace phase {
+inline timing::Phase const frame{"frame"};
+inline timing::Phase const poll{"poll"};
+inline timing::Phase const render{"render"};
+inline timing::Phase const record{"record"};
+} // namespace phase
 
-std::vector<vec> position;
-std::vector<vec> velocity;
+// copy: one RenderCopy per particle. batched: every particle as a textured
+// quad in one SDL_RenderGeometry call; falls back to copy if the renderer
+// refuses it. splat: particles rasterized on the CPU into a streaming
+// texture, for when there are more of them than pixels; falls back to
+// batched. SDL_RenderGeometry is new in SDL 2.0.18, so against an older SDL
+// there is no batched mode and copy is the default and the fallback.
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define IDEAL_GAS_BATCHED 1
+#endif
+enum class RenderMode { copy, batched, splat };
+#ifdef IDEAL_GAS_BATCHED
+RenderMode render_mode = RenderMode::batched;
+#else
+RenderMode render_mode = RenderMode::copy;
+#endif
 
-fptype radius = 5;
+// A heatmap drawn over the particles: particles per area, or mean kinetic
+// energy per particle, tile by tile. H cycles through them.
+enum class Overlay { none, density, temperature };
+std::atomic<Overlay> overlay = Overlay::none;
 
-int world_width = 300;
-int world_height = world_width;
+#ifdef IDEAL_GAS_BATCHED
+// Vertex and index buffers for the batched mode. They only ever grow, and
+// the indices only depend on the particle count, so a steady frame
+// allocates nothing and just rewrites vertex positions.
+struct QuadBatch {
+  static constexpr float corners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+  std::vector<SDL_Vertex> vertices;
+  std::vector<int> indices;
 
-auto constexpr update_step = 20ms;
+  void resize(std::size_t n) {
+    auto const old = indices.size() / 6;
+    if(old >= n) return;
+    vertices.resize(4 * n);
+    for(auto v = 4 * old; v < 4 * n; ++v)
+      vertices[v] = {{},
+                     {255, 255, 255, 255},
+                     {corners[v % 4][0], corners[v % 4][1]}};
+    indices.resize(6 * n);
+    for(auto q = old; q < n; ++q) {
+      int const v = static_cast<int>(4 * q);
+      int const quad[] = {v, v + 1, v + 2, v, v + 2, v + 3};
+      std::copy(std::begin(quad), std::end(quad), indices.begin() + 6 * q);
+    }
+  }
+};
+#endif
 
-inline auto clamp(fptype low, fptype high, fptype x) {
-  return std::max(low, std::min(high, x));
-}
-#define FN(...) [&](auto _) { return __VA_ARGS__; }
-vec in_bounds(vec x) {
-  auto clamper = FN(clamp(radius, world_height - radius, _));
-  return {clamper(x.real()), clamper(x.imag())};
-}
+// The splat mode's rasterizer. Particles are counted into a world-sized
+// buffer, a byte per pixel, and the counts mapped to grey levels on a log
+// scale, so where particles pile up the picture gets brighter instead of
+// saturating. Each thread takes a horizontal strip, skims every particle
+// and draws those in its rows: a frame is a pass over the particles per
+// thread, one over the pixels and one texture upload, with no per-particle
+// draw calls.
+struct Splat {
+  sdl::unique::Texture texture;
+  int width = 0, height = 0;
+  std::vector<std::uint8_t> counts;
+  std::array<std::uint32_t, 256> shade{};
+  // particles as drawn, and their indices binned by the strips they touch:
+  // strip s has binned[bin_start[s]..bin_start[s + 1])
+  struct Dot {
+    float x, y, r;
+  };
+  std::vector<Dot> dots;
+  std::vector<int> binned;
+  std::vector<std::size_t> bin_start, bin_slot;
+  // pool() belongs to the simulation thread and runs one loop at a time;
+  // the wasm builds have no threads to spare for this
+  std::unique_ptr<ThreadPool> strips;
 
-const fptype col_rad = 5 * radius;
-bool is_collide(int i1, int i2) {
-  return norm(position[i1] - position[i2]) <= col_rad;
-}
+  // false if the renderer has no streaming textures
+  template<class Position, class Size>
+  bool draw(sdl::Renderer* renderer,
+            std::size_t n,
+            Position position,
+            Size size) {
+    if(!texture || width != world_width || height != world_height) {
+      width = world_width;
+      height = world_height;
+      texture.reset(SDL_CreateTexture(renderer,
+                                      SDL_PIXELFORMAT_ARGB8888,
+                                      SDL_TEXTUREACCESS_STREAMING,
+                                      width,
+                                      height));
+      if(!texture) return false;
+      counts.assign(std::size_t(width) * height, 0);
+      for(int c = 0; c < 256; ++c) {
+        auto const grey = static_cast<std::uint32_t>(
+            c ? 120 + 135 * std::log(c) / std::log(255) : 50);
+        shade[c] = 0xff000000 | grey << 16 | grey << 8 | grey;
+      }
+    }
+#ifdef __EMSCRIPTEN__
+    unsigned const threads = 1;
+#else
+    unsigned const threads = num_threads;
+#endif
+    if(!strips || strips->size() != threads)
+      strips = std::make_unique<ThreadPool>(threads);
 
-void collide_update(int i1, int i2) {
-  auto const v1 = velocity[i1];
-  auto const v2 = velocity[i2];
-  auto const p1 = position[i1];
-  auto const p2 = position[i2];
-  // prevent division by 0
-  constexpr fptype smooth = .0001;
-  constexpr fptype offset = .0005;
-  constexpr auto collide1 =
-      [=](vec const v1, vec const v2, vec const p1, vec const p2) {
-        auto const d = (p1 - p2);
-        auto const u = (d + offset) / (norm(d) + smooth);
-        return make_tuple(v1 - (dot(v1 - v2, u) * d), p1 + u * col_rad * .7);
-      };
-  std::tie(velocity[i1], position[i1]) = collide1(v1, v2, p1, p2);
-  std::tie(velocity[i2], position[i2]) = collide1(v2, v1, p2, p1);
-}
+    void* pixels = nullptr;
+    int pitch = 0;
+    if(SDL_LockTexture(texture.get(), nullptr, &pixels, &pitch) < 0)
+      return false;
+    auto const rows = (height + threads - 1) / threads;
+    bin(n, position, size, threads, rows);
+    strips->parallel_for(threads, 1, [&](std::size_t b, std::size_t e) {
+      for(auto strip = b; strip < e; ++strip)
+        fill(static_cast<int>(strip * rows),
+             static_cast<int>(std::min<std::size_t>((strip + 1) * rows,
+                                                    height)),
+             std::span{binned}.subspan(bin_start[strip],
+                                       bin_start[strip + 1] - bin_start[strip]),
+             static_cast<char*>(pixels),
+             pitch);
+    });
+    SDL_UnlockTexture(texture.get());
+    sdl::RenderCopy(
+        renderer, texture.get(), std::nullopt, sdl::Rect{0, 0, width, height});
+    return true;
+  }
 
-void keep_in_bounds(int i) {
-  if(position[i].real() <= radius || position[i].real() >= world_width - radius)
-    velocity[i] = vec{-velocity[i].real(), velocity[i].imag()};
-  if(position[i].imag() <= radius
-     || position[i].imag() >= world_height - radius)
-    velocity[i] = vec{velocity[i].real(), -velocity[i].imag()};
-  position[i] = in_bounds(position[i]);
-}
+ private:
+  // Evaluates every particle once, then counting-sorts the indices by strip
+  // of the given rows, in a chunk of particles per thread: per-chunk strip
+  // counts, a prefix over (strip, chunk), a scatter. A disc across a strip
+  // border goes in the bins of both strips.
+  template<class Position, class Size>
+  void bin(std::size_t n,
+           Position& position,
+           Size& size,
+           unsigned threads,
+           unsigned rows) {
+    auto const count = static_cast<int>(threads);
+    auto const per_chunk = (n + threads - 1) / threads;
+    auto const per_row = 1.f / rows;
+    auto const strip_of = [&](float y) {
+      return static_cast<int>(std::clamp(
+          std::floor(y * per_row), -1.f, static_cast<float>(count)));
+    };
+    // the strips of particle i, as [first, last]
+    auto const span_of = [&](std::size_t i) {
+      auto const& d = dots[i];
+      return std::pair{std::max(0, strip_of(d.y - d.r)),
+                       std::min(count - 1, strip_of(d.y + d.r))};
+    };
+    auto const each_chunk = [&](auto&& f) {
+      strips->parallel_for(threads, 1, [&](std::size_t b, std::size_t e) {
+        for(auto k = b; k < e; ++k)
+          f(k * count, k * per_chunk, std::min(n, (k + 1) * per_chunk));
+      });
+    };
+    dots.resize(n);
+    bin_slot.assign(std::size_t(count) * count, 0);
+    each_chunk([&](std::size_t slots, std::size_t b, std::size_t e) {
+      for(auto i = b; i < e; ++i) {
+        auto const [px, py] = position(i);
+        dots[i] = {px, py, size(i)};
+        auto const [s0, s1] = span_of(i);
+        for(auto s = s0; s <= s1; ++s) ++bin_slot[slots + s];
+      }
+    });
+    bin_start.resize(count + 1);
+    std::size_t at = 0;
+    for(int s = 0; s < count; ++s) {
+      bin_start[s] = at;
+      for(int k = 0; k < count; ++k)
+        at += std::exchange(bin_slot[k * count + s], at);
+    }
+    bin_start[count] = at;
+    binned.resize(at);
+    each_chunk([&](std::size_t slots, std::size_t b, std::size_t e) {
+      for(auto i = b; i < e; ++i) {
+        auto const [s0, s1] = span_of(i);
+        for(auto s = s0; s <= s1; ++s)
+          binned[bin_slot[slots + s]++] = static_cast<int>(i);
+      }
+    });
+  }
+
+  // rows [top, bottom) of the picture, from the particles binned there
+  void fill(int top,
+            int bottom,
+            std::span<int const> mine,
+            char* pixels,
+            int pitch) {
+    if(top >= bottom) return;
+    auto const row = [&](int y) {
+      return counts.data() + std::size_t(y) * width;
+    };
+    std::fill(row(top), row(bottom), std::uint8_t{0});
+    auto const bump = [&](int x, int y) {
+      auto& c = row(y)[x];
+      c += c < 255;
+    };
+    for(auto const i : mine) {
+      auto const [px, py, r] = dots[i];
+      auto const cx = static_cast<int>(px), cy = static_cast<int>(py);
+      if(r < 1) {
+        // the pixel under the centre, and those of its neighbours whose
+        // centre is in the disc, usually none
+        auto const fx = px - cx, fy = py - cy;
+        auto const x0 = std::max(0, cx - (fx + .5f <= r));
+        auto const x1 = std::min(width - 1, cx + (1.5f - fx <= r));
+        auto const y0 = std::max(top, cy - (fy + .5f <= r));
+        auto const y1 = std::min(bottom - 1, cy + (1.5f - fy <= r));
+        for(auto y = y0; y <= y1; ++y)
+          for(auto x = x0; x <= x1; ++x) {
+            auto const dx = x + .5f - px, dy = y + .5f - py;
+            if(dx * dx + dy * dy <= r * r || (x == cx && y == cy)) bump(x, y);
+          }
+        continue;
+      }
+      // pixels whose centre is in the disc
+      auto const y0 = std::max(top, static_cast<int>(std::floor(py - r)));
+      auto const y1 = std::min(bottom - 1, static_cast<int>(py + r));
+      for(auto y = y0; y <= y1; ++y) {
+        auto const dy = y + .5f - py, h2 = r * r - dy * dy;
+        if(h2 < 0) continue;
+        auto const half = std::sqrt(h2);
+        auto const x0 =
+            std::max(0, static_cast<int>(std::ceil(px - half - .5f)));
+        auto const x1 =
+            std::min(width - 1, static_cast<int>(std::floor(px + half - .5f)));
+        for(auto x = x0; x <= x1; ++x) bump(x, y);
+      }
+    }
+    for(auto y = top; y < bottom; ++y) {
+      auto const out = reinterpret_cast<std::uint32_t*>(pixels + y * pitch);
+      auto const in = row(y);
+      for(int x = 0; x < width; ++x) out[x] = shade[in[x]];
+    }
+  }
+};
 
-void update() {
-  for(int i = 0; i < position.size(); ++i) {
-    position[i] += velocity[i] * static_cast<fptype>(update_step.count());
-    keep_in_bounds(i);
+// Draws a Heatmap as a texture of a pixel per tile, stretched over the
+// world and blended over the particles. Values are relative to the whole
+// gas: density on a log scale from a quarter to four times the mean,
+// temperature from zero to twice the mean energy per particle.
+struct HeatOverlay {
+  sdl::unique::Texture texture;
+  int cols = 0, rows = 0;
+  std::vector<std::uint32_t> pixels;
+
+  // inferno-like, from cold/sparse to hot/dense
+  static std::uint32_t colour(double v) {
+    constexpr std::uint8_t stops[][3] = {{0, 0, 4},
+                                         {87, 16, 110},
+                                         {188, 55, 84},
+                                         {249, 142, 9},
+                                         {252, 255, 164}};
+    constexpr int last = std::size(stops) - 1;
+    auto const at = std::clamp(v, 0.0, 1.0) * last;
+    auto const k = std::min(static_cast<int>(at), last - 1);
+    auto const f = at - k;
+    auto argb = std::uint32_t{200} << 24;
+    for(int ch = 0; ch < 3; ++ch)
+      argb |= static_cast<std::uint32_t>(
+                  stops[k][ch] + f * (stops[k + 1][ch] - stops[k][ch]))
+              << (16 - 8 * ch);
+    return argb;
   }
-  for(int i = 0; i < position.size(); ++i)
-    for(int j = 0; j < i; ++j)
-      if(is_collide(i, j))
-        collide_update(i, j);
-}
+
+  void draw(sdl::Renderer* renderer, Heatmap const& heat, Overlay which) {
+    if(which == Overlay::none || heat.count.empty()) return;
+    if(!texture || cols != heat.cols || rows != heat.rows) {
+      cols = heat.cols;
+      rows = heat.rows;
+      texture.reset(SDL_CreateTexture(renderer,
+                                      SDL_PIXELFORMAT_ARGB8888,
+                                      SDL_TEXTUREACCESS_STREAMING,
+                                      cols,
+                                      rows));
+      if(!texture) return;
+      SDL_SetTextureBlendMode(texture.get(), SDL_BLENDMODE_BLEND);
+    }
+    auto particles = 0.0, energy = 0.0;
+    for(std::size_t t = 0; t < heat.count.size(); ++t) {
+      particles += heat.count[t];
+      energy += heat.energy[t];
+    }
+    if(particles == 0) return;
+    auto const mean_count = particles * heat.tile * heat.tile
+                            / (double(world_width) * world_height);
+    auto const mean_energy = energy / particles;
+    pixels.resize(heat.count.size());
+    for(std::size_t t = 0; t < pixels.size(); ++t) {
+      auto const n = heat.count[t];
+      if(!n)
+        pixels[t] = 0;
+      else if(which == Overlay::density)
+        pixels[t] = colour(std::log2(n / mean_count) / 4 + .5);
+      else if(mean_energy > 0)
+        pixels[t] = colour(heat.energy[t] / n / mean_energy / 2);
+      else
+        pixels[t] = colour(0);
+    }
+    SDL_UpdateTexture(texture.get(),
+                      nullptr,
+                      pixels.data(),
+                      cols * static_cast<int>(sizeof(std::uint32_t)));
+    auto const side = [&](int tiles) {
+      return static_cast<int>(std::lround(tiles * heat.tile));
+    };
+    sdl::RenderCopy(renderer,
+                    texture.get(),
+                    std::nullopt,
+                    sdl::Rect{0, 0, side(cols), side(rows)});
+  }
+};
 
 sdl::unique::Texture tex;
-void render(sdl::Renderer* renderer, chrono::milliseconds lag) {
-  auto particle_at = [](auto pos) {
-    return sdl::Rect{static_cast<int>(pos.real() - radius),
-                     static_cast<int>(pos.imag() - radius),
-                     static_cast<int>(2 * radius),
-                     static_cast<int>(2 * radius)};
+#ifdef IDEAL_GAS_BATCHED
+QuadBatch batch;
+#endif
+Splat splat;
+HeatOverlay heat_overlay;
+
+// draws n particles, where position(i) gives particle i's centre and
+// size(i) its radius, and the overlay from heat
+template<class Position, class Size>
+void render(sdl::Renderer* renderer,
+            std::size_t n,
+            Position position,
+            Size size,
+            Heatmap const& heat) {
+  timing::Scope timed{phase::render};
+  auto particle_at = [](float x, float y, float r) {
+    return sdl::Rect{static_cast<int>(x - r),
+                     static_cast<int>(y - r),
+                     static_cast<int>(2 * r),
+                     static_cast<int>(2 * r)};
   };
   sdl::SetRenderDrawColor(renderer, {50, 50, 50, 255});
   sdl::RenderClear(renderer);
   sdl::SetRenderDrawColor(renderer, {200, 200, 200, 255});
-  for(int i = 0; i < position.size(); ++i) {
-    auto pos = position[i] + velocity[i] * static_cast<fptype>(lag.count());
-    sdl::RenderCopy(renderer, tex.get(), std::nullopt, particle_at(pos));
+  if(render_mode == RenderMode::splat
+     && !splat.draw(renderer, n, position, size)) {
+#ifdef IDEAL_GAS_BATCHED
+    std::cerr << "no streaming texture, drawing particles as quads: "
+              << SDL_GetError() << '\n';
+    render_mode = RenderMode::batched;
+#else
+    std::cerr << "no streaming texture, drawing particles one by one: "
+              << SDL_GetError() << '\n';
+    render_mode = RenderMode::copy;
+#endif
+  }
+#ifdef IDEAL_GAS_BATCHED
+  if(render_mode == RenderMode::batched) {
+    batch.resize(n);
+    for(std::size_t i = 0; i < n; ++i) {
+      auto const [px, py] = position(i);
+      auto const r = size(i);
+      for(int k = 0; k < 4; ++k)
+        batch.vertices[4 * i + k].position = {
+            px + (2 * QuadBatch::corners[k][0] - 1) * r,
+            py + (2 * QuadBatch::corners[k][1] - 1) * r};
+    }
+    if(SDL_RenderGeometry(renderer,
+                          tex.get(),
+                          batch.vertices.data(),
+                          static_cast<int>(4 * n),
+                          batch.indices.data(),
+                          static_cast<int>(6 * n))
+       < 0) {
+      std::cerr << "SDL_RenderGeometry failed, drawing particles one by one: "
+                << SDL_GetError() << '\n';
+      render_mode = RenderMode::copy;
+    }
   }
+#endif
+  if(render_mode == RenderMode::copy)
+    for(std::size_t i = 0; i < n; ++i) {
+      auto const [px, py] = position(i);
+      sdl::RenderCopy(
+          renderer, tex.get(), std::nullopt, particle_at(px, py, size(i)));
+    }
+  heat_overlay.draw(renderer, heat, overlay);
   sdl::RenderPresent(renderer);
 }
 
-int main() {
-  sdl::Init(sdl::init::video);
-  finally _ = [] { sdl::Quit(); };
+// Positions published by the simulation thread after each batch of steps.
+struct Frame {
+  double time = 0; // simulated ms
+  std::vector<float> x, y, r;
+  Heatmap heat; // empty without an overlay
+};
+
+// Everything main() reads at startup besides the shared physics parameters;
+// see configure().
+struct Settings {
+  int num_things = 400;
+  std::optional<double> packing; // disc area / world area, sets num_things
+  double max_speed = .03;
+  int big_count = 0; // of num_things, with radius big_radius
+  double big_radius = 50;
+  std::optional<std::uint64_t> seed; // random if not given
+  std::string resume;                  // snapshot to start from
+  std::string snapshot = "ideal-gas.snap";
+  std::string record;                  // trajectory file, if any
+  std::uint64_t record_every = 1;
+  trajectory::Encoding record_encoding = trajectory::Encoding::f32;
+  std::string timing; // "report", a CSV path, or empty for off
+  Overlay overlay = Overlay::none;
+  double heat_tile = 16; // overlay tile side, px
+} settings;
+
+// All options come from the command line and an optional --config file;
+// false if the program should exit.
+bool configure(int argc, char** argv) {
+  config::Options options;
+  config::World world;
+  world.add_to(options);
+  options.value("num-things", "number of particles", settings.num_things);
+  options.add("packing",
+              "fraction of the world covered by particles, instead of "
+              "num-things",
+              [](std::string_view s) {
+                double p = 0;
+                return config::Options::read(s, p) && p > 0 && p < 1
+                       && (settings.packing = p, true);
+              });
+  options.value(
+      "max-speed", "initial speed bound per axis, px/ms", settings.max_speed);
+  options.value("big-count",
+                "particles given big-radius (see --broadphase bvh)",
+                settings.big_count);
+  options.value(
+      "big-radius", "radius of the big particles", settings.big_radius);
+  options.add("seed",
+              "start state seed; the same seed gives the same start at any "
+              "thread count",
+              [](std::string_view s) {
+                std::uint64_t seed = 0;
+                return config::Options::read(s, seed)
+                       && (settings.seed = seed, true);
+              });
+  options.choice("render",
+                 render_mode,
+                 {
+#ifdef IDEAL_GAS_BATCHED
+                     {"batched", RenderMode::batched},
+#endif
+                     {"copy", RenderMode::copy},
+                     {"splat", RenderMode::splat}});
+  options.choice("overlay",
+                 settings.overlay,
+                 {{"none", Overlay::none},
+                  {"density", Overlay::density},
+                  {"temperature", Overlay::temperature}});
+  options.value(
+      "heat-tile", "side of an overlay tile in pixels", settings.heat_tile);
+  options.value("resume", "snapshot to start from", settings.resume);
+  options.value("snapshot", "file S saves a snapshot to", settings.snapshot);
+  options.value("record", "trajectory file to record to", settings.record);
+  options.value(
+      "record-every", "steps between recorded frames", settings.record_every);
+  options.choice("record-encoding",
+                 settings.record_encoding,
+                 {{"f32", trajectory::Encoding::f32},
+                  {"f16", trajectory::Encoding::f16},
+                  {"q16", trajectory::Encoding::q16}});
+  options.value("timing",
+                "per-phase timings on quit: 'report' prints them, anything "
+                "else is a CSV file",
+                settings.timing);
+  if(!options.parse(argc, argv) || !world.apply()) return false;
+  if(settings.packing)
+    settings.num_things =
+        static_cast<int>(*settings.packing * world_width * world_height
+                         / (std::numbers::pi * radius * radius));
+  if(settings.num_things < 0 || settings.record_every < 1
+     || settings.heat_tile <= 0) {
+    std::cerr << "num-things must not be negative, record-every and "
+                 "heat-tile must be positive\n";
+    return false;
+  }
+  return true;
+}
 
-  std::random_device rd;
-  auto gen = std::make_unique<std::mt19937>(rd());
-  auto rand_pos = std::uniform_real_distribution<fptype>{
-      static_cast<fptype>(radius),
-      static_cast<fptype>(world_width - radius)};
+std::unique_ptr<trajectory::Writer> recorder;
+
+void start_recording() {
+  if(settings.record.empty()) return;
+  try {
+    recorder = std::make_unique<trajectory::Writer>(settings.record,
+                                                    settings.record_encoding,
+                                                    sim.particles.size(),
+                                                    world_width,
+                                                    world_height);
+  } catch(std::exception const& e) {
+    std::cerr << e.what() << '\n';
+  }
+}
+
+// Writes the trajectory's index and reports if the file is incomplete.
+void stop_recording() {
+  if(!recorder) return;
+  try {
+    recorder->close();
+  } catch(std::exception const& e) {
+    std::cerr << e.what() << '\n';
+  }
+  recorder.reset();
+}
 
-  constexpr auto max_speed = .03;
-  auto rand_vel = std::uniform_real_distribution<fptype>(-max_speed, max_speed);
+// S saves a snapshot after the current step.
+std::atomic<bool> snapshot_requested = false;
 
-  constexpr int num_things = 400;
-  position.resize(num_things);
-  velocity.resize(num_things);
+void save_snapshot() {
+  try {
+    snapshot::save(settings.snapshot, sim);
+    std::cerr << "saved step " << sim.steps << " to " << settings.snapshot
+              << '\n';
+  } catch(std::exception const& e) {
+    std::cerr << e.what() << '\n';
+  }
+}
 
-  for(int i = 0; i < num_things; ++i)
-    position[i] = {rand_pos(*gen), rand_pos(*gen)};
-  for(int i = 0; i < num_things; ++i)
-    velocity[i] = {rand_vel(*gen), rand_vel(*gen)};
+// Runs the steps sched asks for and feeds back their cost; returns how many.
+int catch_up(StepScheduler& sched, chrono::steady_clock::duration elapsed) {
+  auto const steps = sched.advance(elapsed);
+  // the grid broadphase then has the overlay's sums ready after each step
+  sim.grid.track_energy = overlay != Overlay::none;
+  for(int s = 0; s < steps; ++s) {
+    auto const start = chrono::steady_clock::now();
+    sim.update();
+    if(recorder && sim.steps % settings.record_every == 0) {
+      timing::Scope timed{phase::record};
+      try {
+        recorder->write(sim.steps, sim.time, sim.particles, sim.ids);
+      } catch(std::exception const& e) {
+        std::cerr << e.what() << ", recording stopped\n";
+        recorder.reset();
+      }
+    }
+    sched.measured(chrono::steady_clock::now() - start);
+  }
+  if(snapshot_requested.exchange(false)) save_snapshot();
+  return steps;
+}
+
+// The fixed-timestep loop on its own thread: steps the simulation to keep
+// up with real time and publishes a Frame whenever it stepped, so a slow
+// render never holds up physics and vice versa.
+void simulate(std::stop_token stop, TripleBuffer<Frame>& frames) {
+  StepScheduler sched{update_step};
+  auto last_time = chrono::steady_clock::now();
+  while(!stop.stop_requested()) {
+    auto const this_time = chrono::steady_clock::now();
+    auto const steps = catch_up(sched, this_time - last_time);
+    last_time = this_time;
+    if(steps) {
+      auto& frame = frames.back();
+      frame.time = sim.time;
+      // by id, so interpolation pairs up the same particle across reorders
+      auto const n = sim.particles.size();
+      frame.x.resize(n);
+      frame.y.resize(n);
+      frame.r.resize(n);
+      for(std::size_t i = 0; i < n; ++i) {
+        frame.x[sim.ids[i]] = static_cast<float>(sim.particles.x()[i]);
+        frame.y[sim.ids[i]] = static_cast<float>(sim.particles.y()[i]);
+        frame.r[sim.ids[i]] = static_cast<float>(sim.particles.r()[i]);
+      }
+      if(overlay != Overlay::none)
+        sim.heatmap(settings.heat_tile, frame.heat);
+      else
+        frame.heat.count.clear();
+      frames.publish();
+    }
+    std::this_thread::sleep_until(this_time + sched.until_next());
+  }
+}
+
+// Timings go to the console (in the browser too) or to a CSV file.
+void dump_timings() {
+  auto const& dest = settings.timing;
+  if(!timing::enabled) return;
+  if(dest == "report")
+    timing::report();
+  else if(!timing::write_csv(dest.c_str()))
+    std::cerr << "could not write timings to " << dest << '\n';
+}
+
+int main(int argc, char** argv) {
+  if(!configure(argc, argv)) return 1;
+
+  sdl::Init(sdl::init::video);
+  finally _ = [] { sdl::Quit(); };
+
+  timing::enabled = !settings.timing.empty();
+  overlay = settings.overlay;
+
+  if(!settings.resume.empty()) {
+    try {
+      snapshot::load(settings.resume, sim);
+    } catch(std::exception const& e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    }
+  } else {
+    auto const seed = settings.seed.value_or(
+        std::uint64_t{std::random_device{}()} << 32 | std::random_device{}());
+    std::cerr << "seed " << seed << '\n';
+    if(!sim.randomize(settings.num_things, settings.max_speed, seed))
+      std::cerr << "no room for " << settings.num_things
+                << " particles on a lattice; placed uniformly\n";
+    sim.enlarge(settings.big_count, settings.big_radius);
+  }
+  // size the per-step buffers once, before anything runs
+  sim.grid.build(sim.particles);
+#ifdef IDEAL_GAS_BATCHED
+  batch.resize(sim.particles.size());
+#endif
+  start_recording();
 
   auto window = sdl::CreateWindow("ideal gas",
                                   sdl::window::pos_undefined,
@@ -142,28 +681,109 @@ int main() {
   tex = sdl::CreateTextureFromSurface(renderer.get(),
                                       sdl::LoadBMP("assets/circle.bmp"));
 
-  auto last_time = chrono::high_resolution_clock::now();
-  auto lag = last_time - last_time;
+  // The plain wasm build has no threads, so it keeps stepping on the render
+  // loop; main-mt gets the simulation thread like the native build.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  constexpr bool threaded = false;
+#else
+  constexpr bool threaded = true;
+#endif
+  TripleBuffer<Frame> frames;
+  std::jthread sim_thread;
+  if(threaded) sim_thread = std::jthread{simulate, std::ref(frames)};
+  Frame previous{};
+  Heatmap heat; // the unthreaded overlay's
+  auto arrived = chrono::steady_clock::now();
+  auto interval = chrono::steady_clock::duration{}; // between the last two
+
+  StepScheduler sched{update_step};
+  auto last_time = chrono::steady_clock::now();
 
   emscripten_glue::main_loop([&] {
-    auto this_time = chrono::high_resolution_clock::now();
+    timing::Scope timed{phase::frame};
+    auto this_time = chrono::steady_clock::now();
     auto elapsed_time = this_time - last_time;
-    lag += elapsed_time;
+    last_time = this_time;
 
-    for(; lag >= update_step; lag -= update_step)
-      update();
+    if(!threaded) catch_up(sched, elapsed_time);
 
-    while(auto const event = sdl::NextEvent()) {
-      switch(event->type) {
-        case SDL_QUIT:
-          emscripten_glue::cancel_main_loop();
-          break;
+    {
+      timing::Scope timed{phase::poll};
+      while(auto const event = sdl::NextEvent()) {
+        switch(event->type) {
+          case SDL_QUIT:
+            if(threaded) {
+              sim_thread.request_stop();
+              sim_thread.join();
+            }
+            stop_recording();
+            dump_timings();
+            emscripten_glue::cancel_main_loop();
+            break;
+          case SDL_KEYDOWN:
+            if(event->key.keysym.sym == SDLK_s) snapshot_requested = true;
+            if(event->key.keysym.sym == SDLK_h)
+              overlay = Overlay((int(overlay.load()) + 1) % 3);
+            break;
+        }
       }
     }
 
-    render(renderer.get(), chrono::duration_cast<chrono::milliseconds>(lag));
-
-    last_time = this_time;
+    if(!threaded && sched.skip_render()) return;
+    if(threaded) {
+      // Show the motion between the two latest frames over the real time
+      // that separated them, one batch behind the simulation, instead of
+      // extrapolating.
+      if(frames.fresh_available()) {
+        std::swap(previous, frames.front());
+        frames.acquire();
+        auto const now = chrono::steady_clock::now();
+        interval = now - arrived;
+        arrived = now;
+      }
+      auto const& current = frames.front();
+      auto const alpha =
+          previous.x.size() != current.x.size() || interval.count() <= 0
+              ? 1.f
+              : std::clamp(static_cast<float>(
+                               chrono::duration<double>(
+                                   chrono::steady_clock::now() - arrived)
+                               / interval),
+                           0.f,
+                           1.f);
+      render(
+          renderer.get(),
+          current.x.size(),
+          [&](std::size_t i) {
+            if(alpha == 1) return std::pair{current.x[i], current.y[i]};
+            auto const lerp = [&](float a, float b) {
+              return a + (b - a) * alpha;
+            };
+            return std::pair{lerp(previous.x[i], current.x[i]),
+                             lerp(previous.y[i], current.y[i])};
+          },
+          [&](std::size_t i) { return current.r[i]; },
+          current.heat);
+    } else {
+      auto const x = sim.particles.x(), y = sim.particles.y();
+      auto const vx = sim.particles.vx(), vy = sim.particles.vy();
+      auto const t = static_cast<fptype>(
+          chrono::duration<double, std::milli>(sched.lag()).count());
+      auto const r = sim.particles.r();
+      if(overlay != Overlay::none)
+        sim.heatmap(settings.heat_tile, heat);
+      else
+        heat.count.clear();
+      render(
+          renderer.get(),
+          sim.particles.size(),
+          [&](std::size_t i) {
+            return std::pair{static_cast<float>(x[i] + vx[i] * t),
+                             static_cast<float>(y[i] + vy[i] * t)};
+          },
+          [&](std::size_t i) { return static_cast<float>(r[i]); },
+          heat);
+    }
   });
   return 0;
 }
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Space-filling curve order: Morton (Z-order) keys over the world, and the
+// permutation that sorts particles by them, so particles close in space end
+// up close in memory.
+namespace morton {
+
+// the low 16 bits of v, spaced out to the even bits
+inline std::uint32_t spread(std::uint32_t v) {
+  v &= 0xffff;
+  v = (v | v << 8) & 0x00ff00ff;
+  v = (v | v << 4) & 0x0f0f0f0f;
+  v = (v | v << 2) & 0x33333333;
+  v = (v | v << 1) & 0x55555555;
+  return v;
+}
+
+inline std::uint32_t key(std::uint32_t qx, std::uint32_t qy) {
+  return spread(qx) | spread(qy) << 1;
+}
+
+// Holds the scratch buffers, so sorting the same number of particles again
+// allocates nothing.
+class Sorter {
+ public:
+  // Indices of the particles in Morton order of their positions in a
+  // width x height world; stable, so ties keep their current order.
+  template<class T>
+  std::span<int const> order(std::span<T const> x,
+                             std::span<T const> y,
+                             double width,
+                             double height) {
+    auto const n = x.size();
+    keys_.resize(n);
+    order_.resize(n);
+    auto const sx = 65535 / width, sy = 65535 / height;
+    auto const q = [](double v) {
+      return static_cast<std::uint32_t>(v < 0 ? 0 : v > 65535 ? 65535 : v);
+    };
+    for(std::size_t i = 0; i < n; ++i) {
+      keys_[i] = key(q(x[i] * sx), q(y[i] * sy));
+      order_[i] = static_cast<int>(i);
+    }
+    radix_sort();
+    return order_;
+  }
+
+ private:
+  // LSD radix sort of (key, index), 8 bits a pass; passes whose digit is
+  // the same for every key are skipped
+  void radix_sort() {
+    auto const n = keys_.size();
+    key_tmp_.resize(n);
+    order_tmp_.resize(n);
+    for(int shift = 0; shift < 32; shift += 8) {
+      std::size_t count[257] = {};
+      for(auto const k : keys_) ++count[(k >> shift & 0xff) + 1];
+      if(n && count[(keys_[0] >> shift & 0xff) + 1] == n) continue;
+      for(int d = 0; d < 256; ++d) count[d + 1] += count[d];
+      for(std::size_t i = 0; i < n; ++i) {
+        auto const to = count[keys_[i] >> shift & 0xff]++;
+        key_tmp_[to] = keys_[i];
+        order_tmp_[to] = order_[i];
+      }
+      std::swap(keys_, key_tmp_);
+      std::swap(order_, order_tmp_);
+    }
+  }
+
+  std::vector<std::uint32_t> keys_, key_tmp_;
+  std::vector<int> order_, order_tmp_;
+};
+
+} // namespace morton
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <span>
+
+// Per-particle state kept as one array per field (structure of arrays) in a
+// single allocation. Every array starts on a cache line and is padded to a
+// whole number of cache lines, so kernels can stream x, y, vx and vy with
+// aligned packed loads and may run full vectors over the padding.
+template<class T>
+class ParticleStore {
+ public:
+  static constexpr std::size_t alignment = 64;
+  static constexpr std::size_t lanes = alignment / sizeof(T);
+
+  enum Field { X, Y, VX, VY, R, num_fields }; // R: radius
+
+  ParticleStore() = default;
+  explicit ParticleStore(std::size_t n) { resize(n); }
+
+  // Reallocates and zeroes all fields; only meant for setup.
+  void resize(std::size_t n) {
+    n_ = n;
+    stride_ = (n + lanes - 1) / lanes * lanes;
+    auto const bytes = std::max<std::size_t>(
+        num_fields * stride_ * sizeof(T), alignment);
+    data_ = Block{static_cast<T*>(
+                      ::operator new(bytes, std::align_val_t{alignment})),
+                  Release{}};
+    std::fill_n(data_.get(), num_fields * stride_, T{});
+  }
+
+  // Takes over storage laid out as resize(n) would lay it out (aligned,
+  // bytes() long), e.g. a memory-mapped snapshot; release gets it back when
+  // the store is done with it.
+  void adopt(T* data, std::size_t n, std::function<void(T*)> release) {
+    n_ = n;
+    stride_ = (n + lanes - 1) / lanes * lanes;
+    data_ = Block{data, Release{std::move(release)}};
+  }
+
+  // the whole block, fields and padding
+  T* data() { return data_.get(); }
+  T const* data() const { return data_.get(); }
+  std::size_t bytes() const { return num_fields * stride_ * sizeof(T); }
+
+  std::size_t size() const { return n_; }
+  // size rounded up to a multiple of lanes; the tail is scratch space
+  std::size_t padded_size() const { return stride_; }
+
+  std::span<T> field(Field f) { return {data_.get() + f * stride_, n_}; }
+  std::span<T const> field(Field f) const {
+    return {data_.get() + f * stride_, n_};
+  }
+
+  std::span<T> x() { return field(X); }
+  std::span<T> y() { return field(Y); }
+  std::span<T> vx() { return field(VX); }
+  std::span<T> vy() { return field(VY); }
+  std::span<T> r() { return field(R); }
+  std::span<T const> x() const { return field(X); }
+  std::span<T const> y() const { return field(Y); }
+  std::span<T const> vx() const { return field(VX); }
+  std::span<T const> vy() const { return field(VY); }
+  std::span<T const> r() const { return field(R); }
+
+ private:
+  struct Release {
+    std::function<void(T*)> release = [](T* p) {
+      ::operator delete(p, std::align_val_t{alignment});
+    };
+    void operator()(T* p) const { release(p); }
+  };
+  using Block = std::unique_ptr<T[], Release>;
+  Block data_;
+  std::size_t n_ = 0;
+  std::size_t stride_ = 0;
+};
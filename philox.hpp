@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+// 3"): a counter-based generator, so the n-th number of a stream is a pure
+// function of (key, counter) and any particle's draws can be made on any
+// thread, in any order, with the same result.
+namespace philox {
+
+using Block = std::array<std::uint32_t, 4>;
+
+inline Block block(Block c, std::uint64_t key) {
+  constexpr std::uint64_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+  auto k0 = static_cast<std::uint32_t>(key);
+  auto k1 = static_cast<std::uint32_t>(key >> 32);
+  for(int round = 0; round < 10; ++round) {
+    auto const p0 = m0 * c[0], p1 = m1 * c[2];
+    c = {static_cast<std::uint32_t>(p1 >> 32) ^ c[1] ^ k0,
+         static_cast<std::uint32_t>(p1),
+         static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k1,
+         static_cast<std::uint32_t>(p0)};
+    k0 += 0x9E3779B9;
+    k1 += 0xBB67AE85;
+  }
+  return c;
+}
+
+// The numbers of one (seed, id) pair, two doubles per block.
+class Stream {
+ public:
+  Stream(std::uint64_t seed, std::uint64_t id) : seed_{seed}, id_{id} {}
+
+  // uniform in [0, 1), 53 bits
+  double uniform() {
+    if(used_ == 4) {
+      bits_ = block({static_cast<std::uint32_t>(id_),
+                     static_cast<std::uint32_t>(id_ >> 32),
+                     static_cast<std::uint32_t>(counter_),
+                     static_cast<std::uint32_t>(counter_ >> 32)},
+                    seed_);
+      ++counter_;
+      used_ = 0;
+    }
+    auto const bits = std::uint64_t{bits_[used_]} << 32 | bits_[used_ + 1];
+    used_ += 2;
+    return static_cast<double>(bits >> 11) * 0x1p-53;
+  }
+
+  double uniform(double lo, double hi) { return lo + (hi - lo) * uniform(); }
+
+ private:
+  std::uint64_t seed_, id_, counter_ = 0;
+  Block bits_{};
+  int used_ = 4;
+};
+
+} // namespace philox
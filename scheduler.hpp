@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+#include "timing.hpp"
+
+namespace gauge {
+// 0 on time, 1 dropped catch-up steps, 2 slowed simulated time,
+// 3 also skipping render frames
+inline timing::Gauge degradation{"degradation"};
+inline timing::Gauge time_scale{"time_scale"};
+inline timing::Gauge dropped_ms{"dropped_ms"};
+} // namespace gauge
+
+// Turns real time into a number of fixed steps without a spiral of death:
+// catch-up is capped at max_catch_up steps per call and anything beyond that
+// is dropped, and once a step costs more than budget of its own length in
+// real time, simulated time is slowed so stepping fits the budget again.
+// When that is not enough (time_scale below 1/2), skip_render() asks the
+// caller to draw only every other frame.
+class StepScheduler {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  explicit StepScheduler(clock::duration step,
+                         int max_catch_up = 5,
+                         double budget = .8)
+      : step_{step}, max_catch_up_{max_catch_up}, budget_{budget} {}
+
+  // Real time since the last call; returns how many steps to run now.
+  int advance(clock::duration elapsed) {
+    lag_ += std::chrono::duration_cast<clock::duration>(elapsed * scale_);
+    auto steps = static_cast<int>(lag_ / step_);
+    dropping_ = steps > max_catch_up_;
+    if(dropping_) {
+      dropped_ += (steps - max_catch_up_) * step_;
+      steps = max_catch_up_;
+      lag_ %= step_;
+    } else
+      lag_ -= steps * step_;
+    report();
+    return steps;
+  }
+
+  // Feed the real cost of each step.
+  void measured(clock::duration cost) {
+    constexpr double smoothing = .1;
+    cost_ += (std::chrono::duration<double>(cost).count() - cost_) * smoothing;
+    auto const step = std::chrono::duration<double>(step_).count();
+    scale_ = std::min(1.0, budget_ * step / std::max(cost_, 1e-9));
+  }
+
+  int level() const {
+    return scale_ < .5 ? 3 : scale_ < 1 ? 2 : dropping_ ? 1 : 0;
+  }
+  double time_scale() const { return scale_; }
+
+  // simulated time not yet stepped, for extrapolating a frame
+  clock::duration lag() const { return lag_; }
+  // real time until the next step is due
+  clock::duration until_next() const {
+    return std::chrono::duration_cast<clock::duration>((step_ - lag_) / scale_);
+  }
+
+  bool skip_render() {
+    skipped_ = level() == 3 && !skipped_;
+    return skipped_;
+  }
+
+ private:
+  void report() const {
+    gauge::degradation.set(level());
+    gauge::time_scale.set(scale_);
+    gauge::dropped_ms.set(
+        std::chrono::duration<double, std::milli>(dropped_).count());
+  }
+
+  clock::duration step_;
+  int max_catch_up_;
+  double budget_;
+  clock::duration lag_{};
+  clock::duration dropped_{};
+  double cost_ = 0; // smoothed seconds per step
+  double scale_ = 1;
+  bool dropping_ = false;
+  bool skipped_ = false;
+};
@@ -0,0 +1,795 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "bvh.hpp"
+#include "edmd.hpp"
+#include "morton.hpp"
+#include "particle_store.hpp"
+#include "philox.hpp"
+#include "simd.hpp"
+#include "thread_pool.hpp"
+#include "timing.hpp"
+
+// The physics core, shared by the SDL app and the headless benchmark.
+// Particle state and kernels are templated on the scalar type; the world
+// parameters below are shared by every precision.
+
+#ifndef IDEAL_GAS_FPTYPE
+#define IDEAL_GAS_FPTYPE double
+#endif
+// precision the app simulates in, see IDEAL_GAS_FLOAT in CMakeLists.txt
+using fptype = IDEAL_GAS_FPTYPE;
+
+inline double radius = 5;
+
+inline int world_width = 300;
+inline int world_height = world_width;
+
+inline std::chrono::milliseconds update_step{20};
+
+// squared collision distance, see is_collide
+inline double col_rad = 5 * radius;
+
+// grid, verlet and sweep treat every particle as having the global radius;
+// bvh reads each particle's own
+enum class Broadphase { brute, grid, verlet, sweep, bvh };
+inline Broadphase broadphase = Broadphase::grid;
+
+// margin of the Verlet lists beyond the collision reach, in px
+inline double skin = 2;
+
+// steps between sorting particles into Morton order, 0 for never
+inline int reorder_every = 0;
+
+// where randomize() puts particles: uniformly, overlaps and all, or each in
+// its own cell of a lattice, jittered no further than keeps every pair out
+// of collision reach
+enum class Placement { uniform, lattice };
+inline Placement placement = Placement::lattice;
+
+namespace gauge {
+// steps between the last two Verlet list builds, and neighbours per particle
+inline timing::Gauge verlet_interval{"verlet_interval"};
+inline timing::Gauge verlet_neighbours{"verlet_neighbours"};
+} // namespace gauge
+
+namespace phase {
+inline timing::Phase const update{"update"};
+inline timing::Phase const integrate{"integrate"};
+inline timing::Phase const broadphase{"broadphase"};
+// narrow phase and response run interleaved, block by block
+inline timing::Phase const collide{"collide"};
+inline timing::Phase const events{"events"};
+inline timing::Phase const reorder{"reorder"};
+} // namespace phase
+
+// fixed update_step with overlap resolution, or exact hard-disk events
+enum class Engine { timestep, event_driven };
+inline Engine engine = Engine::timestep;
+
+// Most threads pool() may use. The wasm pthreads build (main-mt, see
+// CMakeLists.txt) starts its workers with the page: a thread created later
+// only starts once the browser's main thread yields, so a pool blocking on
+// it there would hang. The plain wasm build has no threads at all.
+#if defined(__EMSCRIPTEN_PTHREADS__)
+inline constexpr unsigned max_threads = IDEAL_GAS_WASM_THREADS;
+#elif defined(__EMSCRIPTEN__)
+inline constexpr unsigned max_threads = 1;
+#else
+inline constexpr unsigned max_threads = 1024;
+#endif
+
+inline unsigned num_threads =
+    std::clamp(std::thread::hardware_concurrency(), 1u, max_threads);
+
+inline ThreadPool& pool() {
+  static std::unique_ptr<ThreadPool> p;
+  if(!p || p->size() != num_threads)
+    p = std::make_unique<ThreadPool>(num_threads);
+  return *p;
+}
+
+// is_collide compares a squared distance against col_rad, so the actual
+// reach is sqrt(col_rad). Cells of that size mean colliding pairs are always
+// in the same or adjacent cells.
+template<class T>
+struct Grid {
+  T cell_size = 0;
+  int cols = 0, rows = 0;
+  std::vector<int> cell_of;    // cell index per particle
+  std::vector<int> cell_start; // particles of cell c: items[cell_start[c]..]
+  std::vector<int> items;
+  // with track_energy, build() also sums each cell's kinetic energy (unit
+  // mass) in the pass that counts its particles
+  bool track_energy = false;
+  std::vector<double> cell_energy;
+  // build() scratch: particles grouped by row band, and the slots of each
+  // (chunk, band) pair
+  std::vector<int> by_band, band_start, band_slot;
+
+  int cell_coord(T x, int n) const {
+    return std::clamp(static_cast<int>(x / cell_size), 0, n - 1);
+  }
+
+  // Counting sort of particle indices by cell, in two stable passes on
+  // pool(): chunks of particles first sort themselves into bands of whole
+  // rows (per-chunk band histograms, a prefix over (band, chunk), then a
+  // scatter), and each band then sorts its own particles into its own cells.
+  // items ends up ordered by cell, then index, for any number of threads.
+  void build(ParticleStore<T> const& particles,
+             double cell = std::sqrt(col_rad)) {
+    cell_size = static_cast<T>(cell);
+    cols = std::max(1, static_cast<int>(std::ceil(world_width / cell_size)));
+    rows = std::max(1, static_cast<int>(std::ceil(world_height / cell_size)));
+    auto const n = static_cast<int>(particles.size());
+    auto const x = particles.x(), y = particles.y();
+    auto const vx = particles.vx(), vy = particles.vy();
+    cell_of.resize(n);
+    items.resize(n);
+    by_band.resize(n);
+    cell_start.resize(cols * rows + 1);
+    cell_energy.resize(track_energy ? cols * rows : 0);
+
+    auto& threads = pool();
+    auto const workers = static_cast<int>(threads.size());
+    auto const chunks = std::clamp((n + 4095) / 4096, 1, workers);
+    auto const per_chunk = (n + chunks - 1) / chunks;
+    auto const band_rows = (rows + 4 * workers - 1) / (4 * workers);
+    auto const bands = (rows + band_rows - 1) / band_rows;
+    auto const band_of = [&](int i) { return cell_of[i] / cols / band_rows; };
+    auto const each_chunk = [&](auto&& f) {
+      threads.parallel_for(chunks, 1, [&](std::size_t b, std::size_t e) {
+        for(auto k = int(b); k < int(e); ++k)
+          f(k, k * per_chunk, std::min(n, (k + 1) * per_chunk));
+      });
+    };
+
+    band_slot.assign(chunks * bands, 0);
+    each_chunk([&](int k, int b, int e) {
+      for(int i = b; i < e; ++i) {
+        auto const cy = cell_coord(y[i], rows);
+        cell_of[i] = cy * cols + cell_coord(x[i], cols);
+        ++band_slot[k * bands + cy / band_rows];
+      }
+    });
+    band_start.resize(bands + 1);
+    for(int band = 0, at = 0; band < bands; ++band) {
+      band_start[band] = at;
+      for(int k = 0; k < chunks; ++k)
+        at += std::exchange(band_slot[k * bands + band], at);
+    }
+    band_start[bands] = n;
+    each_chunk([&](int k, int b, int e) {
+      for(int i = b; i < e; ++i)
+        by_band[band_slot[k * bands + band_of(i)]++] = i;
+    });
+
+    // Each band's cells are contiguous. Count into cell_start, turn it into
+    // cell ends, then scatter backwards so it is left holding the starts.
+    threads.parallel_for(bands, 1, [&](std::size_t b, std::size_t e) {
+      for(auto band = int(b); band < int(e); ++band) {
+        auto const c0 = band * band_rows * cols;
+        auto const c1 = std::min(rows, (band + 1) * band_rows) * cols;
+        auto const s0 = band_start[band], s1 = band_start[band + 1];
+        std::fill(cell_start.begin() + c0, cell_start.begin() + c1, 0);
+        if(track_energy)
+          std::fill(cell_energy.begin() + c0, cell_energy.begin() + c1, 0);
+        for(int s = s0; s < s1; ++s) {
+          auto const i = by_band[s];
+          ++cell_start[cell_of[i]];
+          if(track_energy)
+            cell_energy[cell_of[i]] +=
+                (double(vx[i]) * vx[i] + double(vy[i]) * vy[i]) / 2;
+        }
+        for(int c = c0, at = s0; c < c1; ++c)
+          cell_start[c] = at += cell_start[c];
+        for(int s = s1; s-- > s0;) {
+          auto const i = by_band[s];
+          items[--cell_start[cell_of[i]]] = i;
+        }
+      }
+    });
+    cell_start[cols * rows] = n;
+  }
+
+  // Candidate pairs of one cell, as f(i, block) for each particle i in the
+  // cell and each contiguous block of candidates: the rest of the cell, then
+  // the right/below-left/below/below-right neighbours (half stencil).
+  template<class F>
+  std::uint64_t cell_pairs(int cx, int cy, F& f) const {
+    constexpr int stencil[][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+    auto tests = std::uint64_t{0};
+    auto const c = cy * cols + cx;
+    auto const block = [&](int i, int b, int e) {
+      if(b == e) return;
+      f(i, std::span<int const>{items.data() + b, items.data() + e});
+      tests += e - b;
+    };
+    for(int a = cell_start[c]; a < cell_start[c + 1]; ++a) {
+      block(items[a], a + 1, cell_start[c + 1]);
+      for(auto const& [dx, dy] : stencil) {
+        auto const nx = cx + dx, ny = cy + dy;
+        if(nx < 0 || nx >= cols || ny >= rows) continue;
+        auto const nc = ny * cols + nx;
+        block(items[a], cell_start[nc], cell_start[nc + 1]);
+      }
+    }
+    return tests;
+  }
+
+  // Calls visit(cx, cy) on every non-empty cell, summing what it returns.
+  // A cell's half stencil only touches columns cx-1..cx+1 and rows cy..cy+1,
+  // so cells with equal (cx % 3, cy % 2) never share a particle and each of
+  // those six colours can run concurrently, one task per row. Colours run in
+  // a fixed order, so the result does not depend on the number of threads.
+  template<class F>
+  std::uint64_t for_each_cell(ThreadPool& pool, F&& visit) const {
+    std::atomic<std::uint64_t> total{0};
+    for(int oy = 0; oy < 2; ++oy)
+      for(int ox = 0; ox < 3; ++ox)
+        pool.parallel_for(
+            (rows - oy + 1) / 2, 8, [&](std::size_t b, std::size_t e) {
+              auto t = std::uint64_t{0};
+              for(auto r = b; r < e; ++r) {
+                auto const cy = oy + 2 * static_cast<int>(r);
+                for(int cx = ox; cx < cols; cx += 3) {
+                  auto const c = cy * cols + cx;
+                  if(cell_start[c] != cell_start[c + 1]) t += visit(cx, cy);
+                }
+              }
+              total += t;
+            });
+    return total;
+  }
+
+  // Visit every candidate pair once, in blocks as for cell_pairs, returning
+  // how many pairs there were.
+  template<class F>
+  std::uint64_t for_each_pair(ThreadPool& pool, F&& f) const {
+    return for_each_cell(
+        pool, [&](int cx, int cy) { return cell_pairs(cx, cy, f); });
+  }
+};
+
+// Verlet neighbour lists: every pair within reach + skin, found on a grid of
+// that cell size and reused until some particle has moved more than skin / 2
+// since, before which no other pair can have come within reach. The lists
+// are kept in CSR form by grid slot (position in items), so the grid's
+// colouring keeps the parallel pass race-free and deterministic.
+// collide_update's positional push alone can move a particle several px, so
+// in anything but a very dilute gas some particle exceeds skin / 2 every step
+// and the lists are rebuilt each time; gauge::verlet_interval shows it.
+template<class T>
+struct NeighborLists {
+  Grid<T> grid; // as of the last build
+  std::vector<int> slot_of; // grid slot of each particle
+  std::vector<int> start;   // neighbours of slot a: nbrs[start[a]..start[a+1]]
+  std::vector<int> nbrs;
+  std::vector<T> x0, y0; // positions at the last build
+  std::uint64_t builds = 0, uses = 0, uses_at_build = 0;
+
+  void invalidate() { x0.clear(); }
+
+  // whether no particle has moved more than skin / 2 since the last build
+  bool valid(ParticleStore<T> const& p, double skin, ThreadPool& pool) const {
+    if(x0.size() != p.size()) return false;
+    auto const limit = static_cast<T>(skin * skin / 4);
+    auto const x = p.x(), y = p.y();
+    std::atomic<bool> moved{false};
+    pool.parallel_for(p.size(), 4096, [&](std::size_t b, std::size_t e) {
+      auto d = T{0};
+      for(auto i = b; i < e; ++i) {
+        auto const dx = x[i] - x0[i], dy = y[i] - y0[i];
+        d = std::max(d, dx * dx + dy * dy);
+      }
+      if(d > limit) moved = true;
+    });
+    return !moved;
+  }
+
+  void build(ParticleStore<T> const& p,
+             double reach,
+             double skin,
+             ThreadPool& pool) {
+    auto const range = reach + skin;
+    grid.build(p, range);
+    auto const n = static_cast<int>(p.size());
+    auto const x = p.x(), y = p.y();
+    slot_of.resize(n);
+    for(int a = 0; a < n; ++a) slot_of[grid.items[a]] = a;
+
+    // count, then fill; a cell only writes the slots of its own particles
+    auto const r2 = static_cast<T>(range * range);
+    auto const pass = [&](auto&& add) {
+      grid.for_each_cell(pool, [&](int cx, int cy) {
+        auto near = [&](int i, std::span<int const> js) {
+          for(auto const j : js) {
+            auto const dx = x[i] - x[j], dy = y[i] - y[j];
+            if(dx * dx + dy * dy <= r2) add(slot_of[i], j);
+          }
+        };
+        grid.cell_pairs(cx, cy, near);
+        return 0;
+      });
+    };
+    start.assign(n + 1, 0);
+    pass([&](int a, int) { ++start[a + 1]; });
+    for(int a = 0; a < n; ++a) start[a + 1] += start[a];
+    nbrs.resize(start[n]);
+    auto fill = start;
+    pass([&](int a, int j) { nbrs[fill[a]++] = j; });
+
+    x0.assign(x.begin(), x.end());
+    y0.assign(y.begin(), y.end());
+    gauge::verlet_interval.set(double(uses - uses_at_build));
+    gauge::verlet_neighbours.set(n ? double(nbrs.size()) / n : 0);
+    uses_at_build = uses;
+    ++builds;
+  }
+
+  // f(i, neighbours) for each particle with any, by colour as in Grid
+  template<class F>
+  std::uint64_t for_each_pair(ThreadPool& pool, F&& f) {
+    ++uses;
+    return grid.for_each_cell(pool, [&](int cx, int cy) {
+      auto const c = cy * grid.cols + cx;
+      auto t = std::uint64_t{0};
+      for(int a = grid.cell_start[c]; a < grid.cell_start[c + 1]; ++a) {
+        if(start[a] == start[a + 1]) continue;
+        f(grid.items[a],
+          std::span<int const>{nbrs.data() + start[a],
+                               nbrs.data() + start[a + 1]});
+        t += start[a + 1] - start[a];
+      }
+      return t;
+    });
+  }
+};
+
+// Sweep and prune along x. Particles stay sorted by x between steps, so the
+// insertion sort that restores the order only moves the few that passed one
+// another; a badly shuffled order (new particles, a reorder) gets a full sort
+// instead. A particle's candidates are the ones after it in x order that are
+// within reach along x, contiguous in the order. Suits worlds much wider
+// than high or clustered gases, where the grid is mostly empty cells. The
+// pass is serial.
+template<class T>
+struct SweepAndPrune {
+  std::vector<int> order; // particles by x
+  std::vector<T> xs;      // x of order[k] as of the last sort
+  std::uint64_t full_sorts = 0;
+
+  void invalidate() { order.clear(); }
+
+  void sort(ParticleStore<T> const& p) {
+    auto const n = p.size();
+    auto const x = p.x();
+    xs.resize(n);
+    if(order.size() == n) {
+      for(std::size_t k = 0; k < n; ++k) xs[k] = x[order[k]];
+      auto const budget = 8 * n + 64;
+      auto moves = std::size_t{0};
+      for(std::size_t k = 1; k < n && moves <= budget; ++k) {
+        auto const v = xs[k];
+        auto const i = order[k];
+        auto j = k;
+        for(; j > 0 && xs[j - 1] > v; --j) {
+          xs[j] = xs[j - 1];
+          order[j] = order[j - 1];
+        }
+        xs[j] = v;
+        order[j] = i;
+        moves += k - j;
+      }
+      if(moves <= budget) return;
+    } else {
+      order.resize(n);
+      std::iota(order.begin(), order.end(), 0);
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+      return x[a] < x[b];
+    });
+    for(std::size_t k = 0; k < n; ++k) xs[k] = x[order[k]];
+    ++full_sorts;
+  }
+
+  // f(i, block) per particle as for Grid::cell_pairs, over every pair with
+  // dx^2 <= r2, which includes every pair is_collide accepts
+  template<class F>
+  std::uint64_t for_each_pair(T r2, F&& f) const {
+    auto const n = order.size();
+    auto tests = std::uint64_t{0};
+    auto e = std::size_t{0};
+    for(std::size_t a = 0; a < n; ++a) {
+      e = std::max(e, a + 1);
+      while(e < n && (xs[e] - xs[a]) * (xs[e] - xs[a]) <= r2) ++e;
+      if(e == a + 1) continue;
+      f(order[a], std::span<int const>{order.data() + a + 1, order.data() + e});
+      tests += e - a - 1;
+    }
+    return tests;
+  }
+};
+
+// A coarse picture of the gas: how many particles, and how much kinetic
+// energy, each tile x tile px square holds; see Sim::heatmap.
+struct Heatmap {
+  int cols = 0, rows = 0;
+  double tile = 0;
+  std::vector<int> count;
+  std::vector<double> energy;
+};
+
+template<class T>
+struct Sim {
+  ParticleStore<T> particles;
+  Grid<T> grid;
+  NeighborLists<T> verlet;
+  SweepAndPrune<T> sweep;
+  Bvh<T> bvh;
+  // set while engine is event_driven; dropped whenever particles change
+  // behind its back
+  std::optional<EventDriven<T>> events;
+  // particle i started out as particle ids[i], whatever reorder() did since
+  std::vector<int> ids;
+  double time = 0;
+  std::uint64_t steps = 0;
+  // what randomize() drew the start state from
+  std::uint64_t seed = 0;
+  // candidate pairs handed to the narrow phase (or event predictions), for
+  // benchmarking
+  std::uint64_t pair_tests = 0;
+
+  bool is_collide(int i1, int i2) const {
+    auto const dx = particles.x()[i1] - particles.x()[i2];
+    auto const dy = particles.y()[i1] - particles.y()[i2];
+    return dx * dx + dy * dy <= static_cast<T>(col_rad);
+  }
+
+  void collide_update(int i1, int i2) {
+    collide_update(i1, i2, static_cast<T>(col_rad * .7), 1, 1);
+  }
+
+  // push scales the positional correction; w1 and w2 scale each particle's
+  // share of the response, both 1 for equal masses
+  void collide_update(int i1, int i2, T push, T w1, T w2) {
+    auto x = particles.x(), y = particles.y();
+    auto vx = particles.vx(), vy = particles.vy();
+    // prevent division by 0
+    constexpr T smooth = .0001;
+    constexpr T offset = .0005;
+    // Component form of the original complex-number update:
+    //   u = (d + offset) / (|d|^2 + smooth)
+    //   v1 -= ((v1 - v2) * conj(u)) * d,  p1 += u * col_rad * .7
+    auto const collide1 = [=](int i, int j, T w) {
+      auto const dx = x[i] - x[j], dy = y[i] - y[j];
+      auto const s = 1 / (dx * dx + dy * dy + smooth);
+      auto const ux = (dx + offset) * s, uy = dy * s;
+      auto const ax = vx[i] - vx[j], ay = vy[i] - vy[j];
+      auto const wr = ax * ux + ay * uy, wi = ay * ux - ax * uy;
+      return std::array{vx[i] - w * (wr * dx - wi * dy),
+                        vy[i] - w * (wr * dy + wi * dx),
+                        x[i] + w * ux * push,
+                        y[i] + w * uy * push};
+    };
+    auto const a = collide1(i1, i2, w1);
+    auto const b = collide1(i2, i1, w2);
+    std::tie(vx[i1], vy[i1], x[i1], y[i1]) = std::tuple_cat(a);
+    std::tie(vx[i2], vy[i2], x[i2], y[i2]) = std::tuple_cat(b);
+  }
+
+  void update() {
+    timing::Scope timed{phase::update};
+    time += update_step.count();
+    ++steps;
+    if(engine == Engine::event_driven) {
+      timing::Scope timed{phase::events};
+      // the step engine's collision distance, sqrt(col_rad), as diameter
+      if(!events)
+        events.emplace(std::sqrt(col_rad),
+                       radius,
+                       world_width - radius,
+                       radius,
+                       world_height - radius);
+      auto const before = events->stats.predictions;
+      events->advance(particles, time - update_step.count(), time);
+      pair_tests += events->stats.predictions - before;
+      return;
+    }
+    events.reset();
+    if(reorder_every > 0 && steps % reorder_every == 0) reorder();
+
+    auto const n = static_cast<int>(particles.size());
+    auto const x = particles.x(), y = particles.y();
+    auto const vx = particles.vx(), vy = particles.vy();
+    auto const dt = static_cast<T>(update_step.count());
+    auto const r = static_cast<T>(radius);
+    {
+      timing::Scope timed{phase::integrate};
+      pool().parallel_for(n, 4096, [&](std::size_t b, std::size_t e) {
+        simd::integrate_axis(
+            x.data(), vx.data(), b, e, dt, r, static_cast<T>(world_width - r));
+        simd::integrate_axis(
+            y.data(), vy.data(), b, e, dt, r, static_cast<T>(world_height - r));
+      });
+    }
+    // Narrow phase over a block of candidates at once; i's position is taken
+    // at the start of the block, collide_update then sees live values.
+    auto const resolve_block = [&](int i, std::span<int const> js) {
+      int small[64];
+      thread_local std::vector<int> large;
+      if(js.size() > std::size(small) && large.size() < js.size())
+        large.resize(js.size());
+      auto const hits = js.size() > std::size(small) ? large.data() : small;
+      auto const k = simd::collisions(x[i],
+                                      y[i],
+                                      x.data(),
+                                      y.data(),
+                                      js.data(),
+                                      static_cast<int>(js.size()),
+                                      static_cast<T>(col_rad),
+                                      hits);
+      for(int h = 0; h < k; ++h) collide_update(i, hits[h]);
+    };
+    switch(broadphase) {
+      case Broadphase::brute: {
+        timing::Scope timed{phase::collide};
+        for(int i = 0; i < n; ++i)
+          for(int j = 0; j < i; ++j)
+            if(is_collide(i, j)) collide_update(i, j);
+        pair_tests += std::uint64_t(n) * (n - 1) / 2;
+        break;
+      }
+      case Broadphase::grid: {
+        {
+          timing::Scope timed{phase::broadphase};
+          grid.build(particles);
+          grid_step_ = steps;
+        }
+        timing::Scope timed{phase::collide};
+        pair_tests += grid.for_each_pair(pool(), resolve_block);
+        break;
+      }
+      case Broadphase::verlet: {
+        {
+          timing::Scope timed{phase::broadphase};
+          if(!verlet.valid(particles, skin, pool()))
+            verlet.build(particles, std::sqrt(col_rad), skin, pool());
+        }
+        timing::Scope timed{phase::collide};
+        pair_tests += verlet.for_each_pair(pool(), resolve_block);
+        break;
+      }
+      case Broadphase::sweep: {
+        {
+          timing::Scope timed{phase::broadphase};
+          sweep.sort(particles);
+        }
+        timing::Scope timed{phase::collide};
+        pair_tests +=
+            sweep.for_each_pair(static_cast<T>(col_rad), resolve_block);
+        break;
+      }
+      case Broadphase::bvh: {
+        keep_off_walls();
+        auto const radii = std::as_const(particles).r();
+        // reach scales with the radii so that uniform particles collide at
+        // sqrt(col_rad) like everywhere else; heavier particles (mass as
+        // area) take less of the response
+        auto const scale = static_cast<T>(std::sqrt(col_rad) / (2 * radius));
+        {
+          timing::Scope timed{phase::broadphase};
+          bvh.update(
+              particles, radii, scale, world_width, world_height, pool());
+        }
+        timing::Scope timed{phase::collide};
+        pair_tests += bvh.for_each_pair(
+            particles, radii, pool(), [&](int i, int j) {
+              auto const dx = x[i] - x[j], dy = y[i] - y[j];
+              auto const reach = scale * radii[i] + scale * radii[j];
+              auto const reach2 = reach * reach;
+              if(dx * dx + dy * dy > reach2) return;
+              auto const mi = radii[i] * radii[i], mj = radii[j] * radii[j];
+              collide_update(i,
+                             j,
+                             static_cast<T>(reach2 * .7),
+                             2 * mj / (mi + mj),
+                             2 * mi / (mi + mj));
+            });
+        break;
+      }
+    }
+  }
+
+  // integrate keeps every particle radius off the walls; particles bigger
+  // than that bounce at their own radius
+  void keep_off_walls() {
+    auto const x = particles.x(), y = particles.y();
+    auto const vx = particles.vx(), vy = particles.vy();
+    auto const r = std::as_const(particles).r();
+    auto const bounce = [](T& p, T& v, T lo, T hi) {
+      if(p < lo) p = lo, v = std::abs(v);
+      if(p > hi) p = hi, v = -std::abs(v);
+    };
+    for(std::size_t i = 0; i < particles.size(); ++i)
+      if(r[i] > radius) {
+        bounce(x[i], vx[i], r[i], static_cast<T>(world_width - r[i]));
+        bounce(y[i], vy[i], r[i], static_cast<T>(world_height - r[i]));
+      }
+  }
+
+  // Gives the first count particles radius r, for mixtures of sizes.
+  void enlarge(int count, double r) {
+    auto const radii = particles.r();
+    count = std::min(count, static_cast<int>(radii.size()));
+    std::fill_n(radii.begin(), count, static_cast<T>(r));
+    bvh.invalidate();
+  }
+
+  // Sorts the particles along a Morton curve so neighbours in space are
+  // neighbours in memory; ids follow them.
+  void reorder() {
+    timing::Scope timed{phase::reorder};
+    auto const& p = particles;
+    auto const order =
+        morton_.order(p.x(), p.y(), world_width, world_height);
+    auto const n = p.size();
+    if(spare_.size() != n) spare_.resize(n);
+    for(int f = 0; f < ParticleStore<T>::num_fields; ++f) {
+      auto const field = typename ParticleStore<T>::Field(f);
+      auto const from = p.field(field);
+      auto const to = spare_.field(field);
+      pool().parallel_for(n, 4096, [&](std::size_t b, std::size_t e) {
+        for(auto i = b; i < e; ++i) to[i] = from[order[i]];
+      });
+    }
+    spare_ids_.resize(n);
+    for(std::size_t i = 0; i < n; ++i) spare_ids_[i] = ids[order[i]];
+    std::swap(particles, spare_);
+    std::swap(ids, spare_ids_);
+    events.reset();
+    verlet.invalidate();
+    sweep.invalidate();
+    bvh.invalidate();
+  }
+
+  // Random positions and velocities for n particles, placed as `placement`
+  // says. Particle i's values come from the stream (seed, i) and are drawn
+  // in double, so the start state depends only on the seed: not on the
+  // thread count, nor on the precision. Returns false if the lattice has no
+  // room for n particles out of each other's reach (it fits discs of the
+  // reach up to about 0.9 of the area), in which case they are placed
+  // uniformly.
+  bool randomize(int n, double max_speed, std::uint64_t seed) {
+    this->seed = seed;
+    particles.resize(n);
+    ids.resize(n);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::fill(
+        particles.r().begin(), particles.r().end(), static_cast<T>(radius));
+    events.reset();
+    verlet.invalidate();
+    sweep.invalidate();
+    bvh.invalidate();
+
+    auto const sites = lattice_for(n,
+                                   world_width - 2 * radius,
+                                   world_height - 2 * radius,
+                                   std::sqrt(col_rad));
+    auto const j = sites.jitter;
+    auto const lattice = placement == Placement::lattice && j > 0;
+
+    auto const x = particles.x(), y = particles.y();
+    auto const vx = particles.vx(), vy = particles.vy();
+    pool().parallel_for(n, 4096, [&](std::size_t b, std::size_t e) {
+      for(auto i = b; i < e; ++i) {
+        auto draw = philox::Stream{seed, i};
+        if(lattice) {
+          // n of the sites, spread evenly
+          auto const site = i * sites.cols * sites.rows / n;
+          auto const row = site / sites.cols, col = site % sites.cols;
+          auto const cx =
+              radius + (double(col) + (row % 2 ? 1 : .5)) * sites.cell_x;
+          auto const cy = radius + (double(row) + .5) * sites.cell_y;
+          x[i] = static_cast<T>(cx + draw.uniform(-j, j));
+          y[i] = static_cast<T>(cy + draw.uniform(-j, j));
+        } else {
+          x[i] = static_cast<T>(draw.uniform(radius, world_width - radius));
+          y[i] = static_cast<T>(draw.uniform(radius, world_height - radius));
+        }
+        vx[i] = static_cast<T>(draw.uniform(-max_speed, max_speed));
+        vy[i] = static_cast<T>(draw.uniform(-max_speed, max_speed));
+      }
+    });
+    return lattice || placement == Placement::uniform;
+  }
+
+  // Total kinetic energy, accumulated in double, at the masses collisions
+  // use: unit mass, except that the BVH time-stepper weights particles by
+  // area, here relative to a particle of the default radius.
+  double kinetic_energy() const {
+    auto const vx = particles.vx(), vy = particles.vy();
+    auto const r = particles.r();
+    auto const by_area =
+        engine == Engine::timestep && broadphase == Broadphase::bvh;
+    auto e = 0.0;
+    for(std::size_t i = 0; i < particles.size(); ++i) {
+      auto const m = by_area ? double(r[i]) * r[i] / (radius * radius) : 1;
+      e += m * (double(vx[i]) * vx[i] + double(vy[i]) * vy[i]) / 2;
+    }
+    return e;
+  }
+
+  // Particle count and kinetic energy (unit mass) per tile of about tile_px
+  // square, summed from the grid's cells. With Broadphase::grid and
+  // grid.track_energy the last step's grid already has them, as of just
+  // before its collisions, so this only adds up cells; otherwise the grid
+  // is built here first.
+  void heatmap(double tile_px, Heatmap& out) {
+    if(grid_step_ != steps || !grid.track_energy
+       || broadphase != Broadphase::grid) {
+      grid.track_energy = true;
+      grid.build(particles);
+      grid_step_ = steps;
+    }
+    auto const per =
+        std::max(1, static_cast<int>(std::lround(tile_px / grid.cell_size)));
+    out.cols = (grid.cols + per - 1) / per;
+    out.rows = (grid.rows + per - 1) / per;
+    out.tile = per * double(grid.cell_size);
+    out.count.assign(out.cols * out.rows, 0);
+    out.energy.assign(out.cols * out.rows, 0);
+    for(int cy = 0; cy < grid.rows; ++cy)
+      for(int cx = 0; cx < grid.cols; ++cx) {
+        auto const c = cy * grid.cols + cx;
+        auto const t = cy / per * out.cols + cx / per;
+        out.count[t] += grid.cell_start[c + 1] - grid.cell_start[c];
+        out.energy[t] += grid.cell_energy[c];
+      }
+  }
+
+ private:
+  // Sites in rows of a triangular lattice over a w x h area, odd rows
+  // shifted by half a cell. Every particle strays at most jitter along each
+  // axis from its site, so two neighbours close in by at most 2 sqrt(2)
+  // jitter and still stay reach apart; jitter <= 0 means no room.
+  struct Lattice {
+    std::uint64_t cols, rows;
+    double cell_x, cell_y, jitter;
+  };
+  static Lattice lattice_for(int n, double w, double h, double reach) {
+    n = std::max(n, 1);
+    auto const ideal = std::sqrt(n * w / h * std::sqrt(3.0) / 2);
+    Lattice best{1, 1, w, h, -1};
+    for(auto c = std::max(1.0, std::floor(ideal) - 1); c <= ideal + 2; ++c) {
+      auto const cols = static_cast<std::uint64_t>(c);
+      auto const rows = (n + cols - 1) / cols;
+      auto const cell_x = w / (cols + (rows > 1 ? .5 : 0)), cell_y = h / rows;
+      auto const gap = std::min(cell_x, std::hypot(cell_x / 2, cell_y));
+      auto const jitter = (gap - reach) / (2 * std::sqrt(2.0));
+      if(jitter > best.jitter) best = {cols, rows, cell_x, cell_y, jitter};
+    }
+    return best;
+  }
+
+  // step the grid was last built at
+  std::uint64_t grid_step_ = ~std::uint64_t{0};
+  // reorder()'s scratch
+  morton::Sorter morton_;
+  ParticleStore<T> spare_;
+  std::vector<int> spare_ids_;
+};
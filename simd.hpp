@@ -0,0 +1,425 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IDEAL_GAS_X86 1
+#endif
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+// Hand-vectorized kernels for the hot loops, chosen at runtime by CPU, for
+// float and double; in wasm, simd128 is chosen at build time by -msimd128
+// (IDEAL_GAS_WASM_SIMD in CMakeLists.txt), as modules cannot probe for it.
+// Every variant computes exactly what the scalar one does, so switching isa
+// never changes a simulation; that relies on building with
+// -ffp-contract=off, or the compiler may fuse a multiply-add in one of them.
+namespace simd {
+
+// in order of preference
+enum class Isa { scalar, simd128, avx2, avx512 };
+
+inline char const* name(Isa isa) {
+  switch(isa) {
+    case Isa::avx512: return "avx512";
+    case Isa::avx2: return "avx2";
+    case Isa::simd128: return "simd128";
+    default: return "scalar";
+  }
+}
+
+inline bool supported(Isa isa) {
+  switch(isa) {
+#ifdef IDEAL_GAS_X86
+    case Isa::avx512: return __builtin_cpu_supports("avx512f");
+    case Isa::avx2: return __builtin_cpu_supports("avx2");
+#endif
+#ifdef __wasm_simd128__
+    case Isa::simd128: return true;
+#endif
+    case Isa::scalar: return true;
+    default: return false;
+  }
+}
+
+// the best isa no better than want that can run here
+inline Isa cap(Isa want) {
+  while(!supported(want)) want = Isa(int(want) - 1);
+  return want;
+}
+
+inline Isa detect() { return cap(Isa::avx512); }
+
+// may be lowered (never raised) to compare code paths
+inline Isa isa = detect();
+
+// One axis of the integrate step over [b, e): p += v * dt, then anything at
+// or past a wall has v reflected and p clamped into [lo, hi].
+template<class T>
+void integrate_axis_scalar(
+    T* p, T* v, std::size_t b, std::size_t e, T dt, T lo, T hi) {
+  for(auto i = b; i < e; ++i) {
+    auto const q = p[i] + v[i] * dt;
+    v[i] = q <= lo || q >= hi ? -v[i] : v[i];
+    p[i] = std::max(lo, std::min(hi, q));
+  }
+}
+
+// Narrow phase for one particle at (px, py) against the n candidates
+// idx[0..n): writes the candidates within squared distance r2 to out, which
+// needs room for n entries, and returns how many there were.
+template<class T>
+int collisions_scalar(T px,
+                      T py,
+                      T const* x,
+                      T const* y,
+                      int const* idx,
+                      int n,
+                      T r2,
+                      int* out) {
+  int k = 0;
+  for(int j = 0; j < n; ++j) {
+    auto const dx = px - x[idx[j]], dy = py - y[idx[j]];
+    out[k] = idx[j];
+    k += dx * dx + dy * dy <= r2;
+  }
+  return k;
+}
+
+#ifdef IDEAL_GAS_X86
+#define AVX2 [[gnu::target("avx2")]]
+#define AVX512 [[gnu::target("avx512f")]]
+
+AVX2 inline void integrate_axis_avx2(double* p,
+                                     double* v,
+                                     std::size_t b,
+                                     std::size_t e,
+                                     double dt,
+                                     double lo,
+                                     double hi) {
+  auto const vdt = _mm256_set1_pd(dt);
+  auto const vlo = _mm256_set1_pd(lo), vhi = _mm256_set1_pd(hi);
+  auto const sign = _mm256_set1_pd(-0.0);
+  auto i = b;
+  for(; i + 4 <= e; i += 4) {
+    auto const vi = _mm256_loadu_pd(v + i);
+    auto const q = _mm256_add_pd(_mm256_loadu_pd(p + i),
+                                 _mm256_mul_pd(vi, vdt));
+    auto const hit = _mm256_or_pd(_mm256_cmp_pd(q, vlo, _CMP_LE_OQ),
+                                  _mm256_cmp_pd(q, vhi, _CMP_GE_OQ));
+    _mm256_storeu_pd(v + i, _mm256_xor_pd(vi, _mm256_and_pd(hit, sign)));
+    _mm256_storeu_pd(p + i, _mm256_max_pd(vlo, _mm256_min_pd(vhi, q)));
+  }
+  integrate_axis_scalar(p, v, i, e, dt, lo, hi);
+}
+
+AVX2 inline void integrate_axis_avx2(float* p,
+                                     float* v,
+                                     std::size_t b,
+                                     std::size_t e,
+                                     float dt,
+                                     float lo,
+                                     float hi) {
+  auto const vdt = _mm256_set1_ps(dt);
+  auto const vlo = _mm256_set1_ps(lo), vhi = _mm256_set1_ps(hi);
+  auto const sign = _mm256_set1_ps(-0.0f);
+  auto i = b;
+  for(; i + 8 <= e; i += 8) {
+    auto const vi = _mm256_loadu_ps(v + i);
+    auto const q = _mm256_add_ps(_mm256_loadu_ps(p + i),
+                                 _mm256_mul_ps(vi, vdt));
+    auto const hit = _mm256_or_ps(_mm256_cmp_ps(q, vlo, _CMP_LE_OQ),
+                                  _mm256_cmp_ps(q, vhi, _CMP_GE_OQ));
+    _mm256_storeu_ps(v + i, _mm256_xor_ps(vi, _mm256_and_ps(hit, sign)));
+    _mm256_storeu_ps(p + i, _mm256_max_ps(vlo, _mm256_min_ps(vhi, q)));
+  }
+  integrate_axis_scalar(p, v, i, e, dt, lo, hi);
+}
+
+AVX512 inline void integrate_axis_avx512(double* p,
+                                         double* v,
+                                         std::size_t b,
+                                         std::size_t e,
+                                         double dt,
+                                         double lo,
+                                         double hi) {
+  auto const vdt = _mm512_set1_pd(dt);
+  auto const vlo = _mm512_set1_pd(lo), vhi = _mm512_set1_pd(hi);
+  auto const sign = _mm512_set1_epi64(INT64_MIN);
+  auto i = b;
+  for(; i + 8 <= e; i += 8) {
+    auto const vi = _mm512_castpd_si512(_mm512_loadu_pd(v + i));
+    auto const q = _mm512_add_pd(
+        _mm512_loadu_pd(p + i), _mm512_mul_pd(_mm512_castsi512_pd(vi), vdt));
+    auto const hit = _mm512_cmp_pd_mask(q, vlo, _CMP_LE_OQ)
+                     | _mm512_cmp_pd_mask(q, vhi, _CMP_GE_OQ);
+    _mm512_storeu_pd(
+        v + i, _mm512_castsi512_pd(_mm512_mask_xor_epi64(vi, hit, vi, sign)));
+    _mm512_storeu_pd(p + i, _mm512_max_pd(vlo, _mm512_min_pd(vhi, q)));
+  }
+  integrate_axis_scalar(p, v, i, e, dt, lo, hi);
+}
+
+AVX512 inline void integrate_axis_avx512(float* p,
+                                         float* v,
+                                         std::size_t b,
+                                         std::size_t e,
+                                         float dt,
+                                         float lo,
+                                         float hi) {
+  auto const vdt = _mm512_set1_ps(dt);
+  auto const vlo = _mm512_set1_ps(lo), vhi = _mm512_set1_ps(hi);
+  auto const sign = _mm512_set1_epi32(INT32_MIN);
+  auto i = b;
+  for(; i + 16 <= e; i += 16) {
+    auto const vi = _mm512_castps_si512(_mm512_loadu_ps(v + i));
+    auto const q = _mm512_add_ps(
+        _mm512_loadu_ps(p + i), _mm512_mul_ps(_mm512_castsi512_ps(vi), vdt));
+    auto const hit = _mm512_cmp_ps_mask(q, vlo, _CMP_LE_OQ)
+                     | _mm512_cmp_ps_mask(q, vhi, _CMP_GE_OQ);
+    _mm512_storeu_ps(
+        v + i, _mm512_castsi512_ps(_mm512_mask_xor_epi32(vi, hit, vi, sign)));
+    _mm512_storeu_ps(p + i, _mm512_max_ps(vlo, _mm512_min_ps(vhi, q)));
+  }
+  integrate_axis_scalar(p, v, i, e, dt, lo, hi);
+}
+
+AVX2 inline int collisions_avx2(double px,
+                                double py,
+                                double const* x,
+                                double const* y,
+                                int const* idx,
+                                int n,
+                                double r2,
+                                int* out) {
+  auto const vpx = _mm256_set1_pd(px), vpy = _mm256_set1_pd(py);
+  auto const vr2 = _mm256_set1_pd(r2);
+  int k = 0, j = 0;
+  for(; j + 4 <= n; j += 4) {
+    auto const vi = _mm_loadu_si128(reinterpret_cast<__m128i const*>(idx + j));
+    auto const dx = _mm256_sub_pd(vpx, _mm256_i32gather_pd(x, vi, 8));
+    auto const dy = _mm256_sub_pd(vpy, _mm256_i32gather_pd(y, vi, 8));
+    auto const d2 =
+        _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    for(auto m = _mm256_movemask_pd(_mm256_cmp_pd(d2, vr2, _CMP_LE_OQ)); m;
+        m &= m - 1)
+      out[k++] = idx[j + __builtin_ctz(m)];
+  }
+  return k + collisions_scalar(px, py, x, y, idx + j, n - j, r2, out + k);
+}
+
+AVX2 inline int collisions_avx2(float px,
+                                float py,
+                                float const* x,
+                                float const* y,
+                                int const* idx,
+                                int n,
+                                float r2,
+                                int* out) {
+  auto const vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+  auto const vr2 = _mm256_set1_ps(r2);
+  int k = 0, j = 0;
+  for(; j + 8 <= n; j += 8) {
+    auto const vi =
+        _mm256_loadu_si256(reinterpret_cast<__m256i const*>(idx + j));
+    auto const dx = _mm256_sub_ps(vpx, _mm256_i32gather_ps(x, vi, 4));
+    auto const dy = _mm256_sub_ps(vpy, _mm256_i32gather_ps(y, vi, 4));
+    auto const d2 =
+        _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+    for(auto m = _mm256_movemask_ps(_mm256_cmp_ps(d2, vr2, _CMP_LE_OQ)); m;
+        m &= m - 1)
+      out[k++] = idx[j + __builtin_ctz(m)];
+  }
+  return k + collisions_scalar(px, py, x, y, idx + j, n - j, r2, out + k);
+}
+
+AVX512 inline int collisions_avx512(double px,
+                                    double py,
+                                    double const* x,
+                                    double const* y,
+                                    int const* idx,
+                                    int n,
+                                    double r2,
+                                    int* out) {
+  auto const vpx = _mm512_set1_pd(px), vpy = _mm512_set1_pd(py);
+  auto const vr2 = _mm512_set1_pd(r2);
+  int k = 0, j = 0;
+  for(; j + 8 <= n; j += 8) {
+    auto const vi =
+        _mm256_loadu_si256(reinterpret_cast<__m256i const*>(idx + j));
+    auto const dx = _mm512_sub_pd(vpx, _mm512_i32gather_pd(vi, x, 8));
+    auto const dy = _mm512_sub_pd(vpy, _mm512_i32gather_pd(vi, y, 8));
+    auto const d2 =
+        _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+    for(unsigned m = _mm512_cmp_pd_mask(d2, vr2, _CMP_LE_OQ); m; m &= m - 1)
+      out[k++] = idx[j + __builtin_ctz(m)];
+  }
+  return k + collisions_scalar(px, py, x, y, idx + j, n - j, r2, out + k);
+}
+
+AVX512 inline int collisions_avx512(float px,
+                                    float py,
+                                    float const* x,
+                                    float const* y,
+                                    int const* idx,
+                                    int n,
+                                    float r2,
+                                    int* out) {
+  auto const vpx = _mm512_set1_ps(px), vpy = _mm512_set1_ps(py);
+  auto const vr2 = _mm512_set1_ps(r2);
+  int k = 0, j = 0;
+  for(; j + 16 <= n; j += 16) {
+    auto const vi =
+        _mm512_loadu_si512(reinterpret_cast<__m512i const*>(idx + j));
+    auto const dx = _mm512_sub_ps(vpx, _mm512_i32gather_ps(vi, x, 4));
+    auto const dy = _mm512_sub_ps(vpy, _mm512_i32gather_ps(vi, y, 4));
+    auto const d2 =
+        _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+    for(unsigned m = _mm512_cmp_ps_mask(d2, vr2, _CMP_LE_OQ); m; m &= m - 1)
+      out[k++] = idx[j + __builtin_ctz(m)];
+  }
+  return k + collisions_scalar(px, py, x, y, idx + j, n - j, r2, out + k);
+}
+
+#undef AVX2
+#undef AVX512
+#endif
+
+#ifdef __wasm_simd128__
+// pmin/pmax are exactly std::min/max's b < a ? b : a; wasm has no gathers,
+// so the narrow phase builds its vectors from scalar loads
+
+inline void integrate_axis_simd128(double* p,
+                                   double* v,
+                                   std::size_t b,
+                                   std::size_t e,
+                                   double dt,
+                                   double lo,
+                                   double hi) {
+  auto const vdt = wasm_f64x2_splat(dt);
+  auto const vlo = wasm_f64x2_splat(lo), vhi = wasm_f64x2_splat(hi);
+  auto const sign = wasm_f64x2_splat(-0.0);
+  auto i = b;
+  for(; i + 2 <= e; i += 2) {
+    auto const vi = wasm_v128_load(v + i);
+    auto const q =
+        wasm_f64x2_add(wasm_v128_load(p + i), wasm_f64x2_mul(vi, vdt));
+    auto const hit = wasm_v128_or(wasm_f64x2_le(q, vlo), wasm_f64x2_ge(q, vhi));
+    wasm_v128_store(v + i, wasm_v128_xor(vi, wasm_v128_and(hit, sign)));
+    wasm_v128_store(p + i, wasm_f64x2_pmax(vlo, wasm_f64x2_pmin(vhi, q)));
+  }
+  integrate_axis_scalar(p, v, i, e, dt, lo, hi);
+}
+
+inline void integrate_axis_simd128(float* p,
+                                   float* v,
+                                   std::size_t b,
+                                   std::size_t e,
+                                   float dt,
+                                   float lo,
+                                   float hi) {
+  auto const vdt = wasm_f32x4_splat(dt);
+  auto const vlo = wasm_f32x4_splat(lo), vhi = wasm_f32x4_splat(hi);
+  auto const sign = wasm_f32x4_splat(-0.0f);
+  auto i = b;
+  for(; i + 4 <= e; i += 4) {
+    auto const vi = wasm_v128_load(v + i);
+    auto const q =
+        wasm_f32x4_add(wasm_v128_load(p + i), wasm_f32x4_mul(vi, vdt));
+    auto const hit = wasm_v128_or(wasm_f32x4_le(q, vlo), wasm_f32x4_ge(q, vhi));
+    wasm_v128_store(v + i, wasm_v128_xor(vi, wasm_v128_and(hit, sign)));
+    wasm_v128_store(p + i, wasm_f32x4_pmax(vlo, wasm_f32x4_pmin(vhi, q)));
+  }
+  integrate_axis_scalar(p, v, i, e, dt, lo, hi);
+}
+
+inline int collisions_simd128(double px,
+                              double py,
+                              double const* x,
+                              double const* y,
+                              int const* idx,
+                              int n,
+                              double r2,
+                              int* out) {
+  auto const vpx = wasm_f64x2_splat(px), vpy = wasm_f64x2_splat(py);
+  auto const vr2 = wasm_f64x2_splat(r2);
+  int k = 0, j = 0;
+  for(; j + 2 <= n; j += 2) {
+    auto const a = idx[j], b = idx[j + 1];
+    auto const dx = wasm_f64x2_sub(vpx, wasm_f64x2_make(x[a], x[b]));
+    auto const dy = wasm_f64x2_sub(vpy, wasm_f64x2_make(y[a], y[b]));
+    auto const d2 =
+        wasm_f64x2_add(wasm_f64x2_mul(dx, dx), wasm_f64x2_mul(dy, dy));
+    for(auto m = wasm_i64x2_bitmask(wasm_f64x2_le(d2, vr2)); m; m &= m - 1)
+      out[k++] = idx[j + __builtin_ctz(m)];
+  }
+  return k + collisions_scalar(px, py, x, y, idx + j, n - j, r2, out + k);
+}
+
+inline int collisions_simd128(float px,
+                              float py,
+                              float const* x,
+                              float const* y,
+                              int const* idx,
+                              int n,
+                              float r2,
+                              int* out) {
+  auto const vpx = wasm_f32x4_splat(px), vpy = wasm_f32x4_splat(py);
+  auto const vr2 = wasm_f32x4_splat(r2);
+  int k = 0, j = 0;
+  for(; j + 4 <= n; j += 4) {
+    auto const i = idx + j;
+    auto const dx = wasm_f32x4_sub(
+        vpx, wasm_f32x4_make(x[i[0]], x[i[1]], x[i[2]], x[i[3]]));
+    auto const dy = wasm_f32x4_sub(
+        vpy, wasm_f32x4_make(y[i[0]], y[i[1]], y[i[2]], y[i[3]]));
+    auto const d2 =
+        wasm_f32x4_add(wasm_f32x4_mul(dx, dx), wasm_f32x4_mul(dy, dy));
+    for(auto m = wasm_i32x4_bitmask(wasm_f32x4_le(d2, vr2)); m; m &= m - 1)
+      out[k++] = i[__builtin_ctz(m)];
+  }
+  return k + collisions_scalar(px, py, x, y, idx + j, n - j, r2, out + k);
+}
+#endif
+
+template<class T>
+void integrate_axis(
+    T* p, T* v, std::size_t b, std::size_t e, T dt, T lo, T hi) {
+  switch(isa) {
+#ifdef IDEAL_GAS_X86
+    case Isa::avx512: return integrate_axis_avx512(p, v, b, e, dt, lo, hi);
+    case Isa::avx2: return integrate_axis_avx2(p, v, b, e, dt, lo, hi);
+#endif
+#ifdef __wasm_simd128__
+    case Isa::simd128: return integrate_axis_simd128(p, v, b, e, dt, lo, hi);
+#endif
+    default: return integrate_axis_scalar(p, v, b, e, dt, lo, hi);
+  }
+}
+
+template<class T>
+int collisions(T px,
+               T py,
+               T const* x,
+               T const* y,
+               int const* idx,
+               int n,
+               T r2,
+               int* out) {
+  switch(isa) {
+#ifdef IDEAL_GAS_X86
+    case Isa::avx512: return collisions_avx512(px, py, x, y, idx, n, r2, out);
+    case Isa::avx2: return collisions_avx2(px, py, x, y, idx, n, r2, out);
+#endif
+#ifdef __wasm_simd128__
+    case Isa::simd128: return collisions_simd128(px, py, x, y, idx, n, r2, out);
+#endif
+    default: return collisions_scalar(px, py, x, y, idx, n, r2, out);
+  }
+}
+
+} // namespace simd
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sim.hpp"
+
+#if !defined(__EMSCRIPTEN__) && __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IDEAL_GAS_MMAP 1
+#endif
+
+// Checkpoints of the full simulation state: particles and their ids, world,
+// collision distance, step length, clock and the seed. The particle block is
+// stored exactly as ParticleStore keeps it, on a page boundary, so a snapshot
+// taken at the same precision is mapped straight into the store
+// (copy-on-write) instead of being read.
+namespace snapshot {
+
+struct Header {
+  char magic[8] = {'I', 'G', 'S', 'N', 'A', 'P', '1', 0};
+  std::uint32_t version = 1;
+  std::uint32_t scalar_bytes = 0; // 4 or 8
+  std::uint64_t particles = 0;
+  std::uint64_t stride = 0; // ParticleStore::padded_size()
+  double radius = 0, col_rad = 0;
+  std::int32_t world_width = 0, world_height = 0;
+  std::int64_t update_step_ms = 0;
+  double time = 0;
+  std::uint64_t steps = 0;
+  std::uint64_t data_offset = 0, data_bytes = 0; // every ParticleStore field
+  std::uint64_t ids_offset = 0;                  // Sim::ids as int32
+  std::uint64_t seed_offset = 0;                 // Sim::seed
+};
+
+inline constexpr std::uint64_t page = 4096;
+
+// Writes to path.tmp first and renames, so a crash never leaves a torn
+// snapshot at path.
+template<class T>
+void save(std::string const& path, Sim<T> const& sim) {
+  auto const& p = sim.particles;
+  Header h;
+  h.scalar_bytes = sizeof(T);
+  h.particles = p.size();
+  h.stride = p.padded_size();
+  h.radius = radius;
+  h.world_width = world_width;
+  h.world_height = world_height;
+  h.col_rad = col_rad;
+  h.update_step_ms = update_step.count();
+  h.time = sim.time;
+  h.steps = sim.steps;
+  h.data_offset = page;
+  h.data_bytes = p.bytes();
+  h.ids_offset = h.data_offset + h.data_bytes;
+  h.seed_offset = h.ids_offset + sim.ids.size() * sizeof(std::int32_t);
+
+  auto const tmp = path + ".tmp";
+  auto const f = std::fopen(tmp.c_str(), "wb");
+  if(!f) throw std::runtime_error{"cannot open " + tmp};
+  std::vector<char> head(page);
+  std::memcpy(head.data(), &h, sizeof h);
+  auto const ok = std::fwrite(head.data(), 1, page, f) == page
+                  && std::fwrite(p.data(), 1, h.data_bytes, f) == h.data_bytes
+                  && std::fwrite(sim.ids.data(), sizeof(int), p.size(), f)
+                         == p.size()
+                  && std::fwrite(&sim.seed, sizeof sim.seed, 1, f) == 1;
+  if(std::fclose(f) != 0 || !ok || std::rename(tmp.c_str(), path.c_str()))
+    throw std::runtime_error{"could not write " + path};
+}
+
+// Restores sim and the world parameters. A snapshot of another
+// precision is converted.
+template<class T>
+void load(std::string const& path, Sim<T>& sim) {
+  auto const f = std::fopen(path.c_str(), "rb");
+  if(!f) throw std::runtime_error{"cannot open " + path};
+  auto fail = [&](char const* why) {
+    std::fclose(f);
+    throw std::runtime_error{path + ": " + why};
+  };
+  Header h;
+  if(std::fread(&h, sizeof h, 1, f) != 1
+     || std::memcmp(h.magic, Header{}.magic, sizeof h.magic))
+    fail("not a snapshot");
+  if(h.version != Header{}.version
+     || (h.scalar_bytes != 4 && h.scalar_bytes != 8))
+    fail("unsupported snapshot");
+  if(!(h.radius > 0 && h.col_rad > 0 && h.update_step_ms > 0
+       && h.world_width > 0 && h.world_height > 0))
+    fail("bad world");
+
+  std::fseek(f, static_cast<long>(h.seed_offset), SEEK_SET);
+  if(std::fread(&sim.seed, sizeof sim.seed, 1, f) != 1) fail("truncated");
+
+  sim.ids.resize(h.particles);
+  std::fseek(f, static_cast<long>(h.ids_offset), SEEK_SET);
+  if(std::fread(sim.ids.data(), sizeof(int), h.particles, f) != h.particles)
+    fail("truncated");
+  // ids index frames and trajectory rows, so they must be a permutation
+  std::vector<bool> seen(h.particles);
+  for(auto const id : sim.ids) {
+    if(id < 0 || std::uint64_t(id) >= h.particles || seen[id]) fail("bad ids");
+    seen[id] = true;
+  }
+
+  auto& p = sim.particles;
+  if(h.stride < h.particles
+     || h.data_bytes != p.num_fields * h.stride * h.scalar_bytes)
+    fail("bad particle layout");
+  auto const same_layout =
+      h.scalar_bytes == sizeof(T)
+      && h.stride == (h.particles + p.lanes - 1) / p.lanes * p.lanes;
+  bool mapped = false;
+#ifdef IDEAL_GAS_MMAP
+  if(same_layout && h.particles) {
+    auto const length = h.data_offset + h.data_bytes;
+    // a mapping past the end of the file faults on access instead of
+    // failing here
+    struct stat st;
+    if(::fstat(::fileno(f), &st) != 0
+       || static_cast<std::uint64_t>(st.st_size) < length)
+      fail("truncated");
+    auto const base = ::mmap(nullptr,
+                             length,
+                             PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE,
+                             ::fileno(f),
+                             0);
+    if(base != MAP_FAILED) {
+      p.adopt(reinterpret_cast<T*>(static_cast<char*>(base) + h.data_offset),
+              h.particles,
+              [base, length](T*) { ::munmap(base, length); });
+      mapped = true;
+    }
+  }
+#endif
+  if(!mapped) {
+    p.resize(h.particles);
+    std::fseek(f, static_cast<long>(h.data_offset), SEEK_SET);
+    if(same_layout) {
+      if(std::fread(p.data(), 1, h.data_bytes, f) != h.data_bytes)
+        fail("truncated");
+    } else {
+      auto const read = [&]<class S>(S) {
+        std::vector<S> buf(h.stride);
+        for(int field = 0; field < p.num_fields; ++field) {
+          if(std::fread(buf.data(), sizeof(S), h.stride, f) != h.stride)
+            fail("truncated");
+          auto const out = p.field(typename ParticleStore<T>::Field(field));
+          std::copy_n(buf.begin(), out.size(), out.begin());
+        }
+      };
+      if(h.scalar_bytes == 4)
+        read(float{});
+      else
+        read(double{});
+    }
+  }
+  std::fclose(f);
+
+  radius = h.radius;
+  world_width = h.world_width;
+  world_height = h.world_height;
+  col_rad = h.col_rad;
+  update_step = std::chrono::milliseconds{h.update_step_ms};
+  sim.time = h.time;
+  sim.steps = h.steps;
+  sim.events.reset();
+  sim.verlet.invalidate();
+  sim.sweep.invalidate();
+  sim.bvh.invalidate();
+}
+
+} // namespace snapshot
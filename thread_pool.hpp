@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads for fork-join loops. parallel_for hands out
+// chunks of an index range from a shared counter; the calling thread works
+// too and returns once every chunk is done. Only one loop runs at a time.
+class ThreadPool {
+ public:
+  explicit ThreadPool(unsigned threads) {
+    for(unsigned i = 1; i < threads; ++i)
+      workers_.emplace_back([this] { work(); });
+  }
+  ThreadPool(ThreadPool const&) = delete;
+  ThreadPool& operator=(ThreadPool const&) = delete;
+  ~ThreadPool() {
+    {
+      std::lock_guard lock{mutex_};
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for(auto& t : workers_) t.join();
+  }
+
+  unsigned size() const { return static_cast<unsigned>(workers_.size()) + 1; }
+
+  // Calls f(begin, end) on disjoint chunks of [0, n), each at most grain long.
+  template<class F>
+  void parallel_for(std::size_t n, std::size_t grain, F&& f) {
+    grain = std::max<std::size_t>(grain, 1);
+    if(workers_.empty() || n <= grain) {
+      if(n) f(std::size_t{0}, n);
+      return;
+    }
+    job_ = {&f,
+            [](void* f, std::size_t b, std::size_t e) {
+              (*static_cast<std::remove_reference_t<F>*>(f))(b, e);
+            },
+            n,
+            grain};
+    next_ = 0;
+    {
+      std::lock_guard lock{mutex_};
+      ++generation_;
+      busy_ = workers_.size();
+    }
+    wake_.notify_all();
+    run_chunks();
+    std::unique_lock lock{mutex_};
+    done_.wait(lock, [&] { return busy_ == 0; });
+  }
+
+ private:
+  struct Job {
+    void* f;
+    void (*call)(void*, std::size_t, std::size_t);
+    std::size_t n, grain;
+  };
+
+  void run_chunks() {
+    for(;;) {
+      auto const b = next_.fetch_add(job_.grain);
+      if(b >= job_.n) return;
+      job_.call(job_.f, b, std::min(b + job_.grain, job_.n));
+    }
+  }
+
+  void work() {
+    std::uint64_t seen = 0;
+    for(;;) {
+      {
+        std::unique_lock lock{mutex_};
+        wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+        if(stop_) return;
+        seen = generation_;
+      }
+      run_chunks();
+      std::lock_guard lock{mutex_};
+      if(--busy_ == 0) done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  std::uint64_t generation_ = 0;
+  std::size_t busy_ = 0;
+  bool stop_ = false;
+  Job job_{};
+  std::atomic<std::size_t> next_{0};
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef IDEAL_GAS_TIMING_RDTSC
+#include <x86intrin.h>
+#define IDEAL_GAS_RDTSC 1
+#endif
+#endif
+
+// Scoped phase timers and gauges. Each thread appends (phase, duration)
+// samples to its own ring buffer, so recording never takes a lock; report()
+// and write_csv() merge the rings and summarize the samples still retained.
+// Durations come from steady_clock, or from rdtsc when built with
+// IDEAL_GAS_TIMING_RDTSC on x86.
+namespace timing {
+
+// off by default; a disabled Scope costs one branch
+inline bool enabled = false;
+
+inline std::uint64_t now() {
+#ifdef IDEAL_GAS_RDTSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+struct Sample {
+  std::uint32_t phase;
+  std::uint64_t ticks;
+};
+
+struct Ring {
+  static constexpr std::size_t capacity = 1 << 16;
+  std::vector<Sample> samples = std::vector<Sample>(capacity);
+  std::uint64_t written = 0;
+  void push(Sample s) { samples[written++ % capacity] = s; }
+};
+
+struct Gauge;
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::string> names;
+  std::vector<Gauge*> gauges;
+  std::vector<std::shared_ptr<Ring>> rings;
+  // for converting ticks to ns
+  std::uint64_t tick0 = now();
+  std::chrono::steady_clock::time_point time0 =
+      std::chrono::steady_clock::now();
+};
+
+inline Registry& registry() {
+  static Registry r;
+  return r;
+}
+
+inline double ns_per_tick() {
+#ifdef IDEAL_GAS_RDTSC
+  auto& r = registry();
+  auto const ns = std::chrono::duration<double, std::nano>(
+                      std::chrono::steady_clock::now() - r.time0)
+                      .count();
+  return ns / std::max<std::uint64_t>(now() - r.tick0, 1);
+#else
+  return 1;
+#endif
+}
+
+inline Ring& ring() {
+  thread_local auto const r = [] {
+    auto r = std::make_shared<Ring>();
+    std::lock_guard lock{registry().mutex};
+    registry().rings.push_back(r);
+    return r;
+  }();
+  return *r;
+}
+
+// a named thing to time, meant to be a global
+struct Phase {
+  std::uint32_t id;
+  explicit Phase(char const* name) {
+    auto& r = registry();
+    std::lock_guard lock{r.mutex};
+    id = static_cast<std::uint32_t>(r.names.size());
+    r.names.emplace_back(name);
+  }
+};
+
+// A named value that is set rather than timed, such as a load level. Keeps
+// the latest and the largest value seen; meant to be a global.
+struct Gauge {
+  char const* name;
+  std::atomic<double> last{0}, max{0};
+  explicit Gauge(char const* name) : name{name} {
+    std::lock_guard lock{registry().mutex};
+    registry().gauges.push_back(this);
+  }
+  void set(double v) {
+    if(!enabled) return;
+    last.store(v, std::memory_order_relaxed);
+    auto m = max.load(std::memory_order_relaxed);
+    while(v > m && !max.compare_exchange_weak(m, v, std::memory_order_relaxed))
+      ;
+  }
+};
+
+class Scope {
+ public:
+  explicit Scope(Phase const& phase)
+      : phase_{phase.id}, on_{enabled}, start_{on_ ? now() : 0} {}
+  Scope(Scope const&) = delete;
+  Scope& operator=(Scope const&) = delete;
+  ~Scope() {
+    if(on_) ring().push({phase_, now() - start_});
+  }
+
+ private:
+  std::uint32_t phase_;
+  bool on_;
+  std::uint64_t start_;
+};
+
+// Drops all samples and gauge values. Only call while no other thread is
+// recording.
+inline void clear() {
+  std::lock_guard lock{registry().mutex};
+  for(auto const& ring : registry().rings) ring->written = 0;
+  for(auto const g : registry().gauges) g->last = g->max = 0;
+}
+
+struct Summary {
+  std::string phase;
+  std::size_t count;
+  double mean, p50, p99, max; // microseconds
+};
+
+// Per-phase statistics over the retained samples of every thread. Only call
+// while no other thread is recording.
+inline std::vector<Summary> summarize() {
+  auto& r = registry();
+  std::lock_guard lock{r.mutex};
+  std::vector<std::vector<double>> us(r.names.size());
+  auto const scale = ns_per_tick() / 1000;
+  for(auto const& ring : r.rings) {
+    auto const n = std::min<std::uint64_t>(ring->written, Ring::capacity);
+    for(std::size_t i = 0; i < n; ++i)
+      us[ring->samples[i].phase].push_back(ring->samples[i].ticks * scale);
+  }
+  std::vector<Summary> out;
+  for(std::size_t p = 0; p < us.size(); ++p) {
+    auto& v = us[p];
+    if(v.empty()) continue;
+    std::sort(v.begin(), v.end());
+    auto const at = [&](double q) {
+      return v[std::min(v.size() - 1, static_cast<std::size_t>(q * v.size()))];
+    };
+    auto sum = 0.0;
+    for(auto x : v) sum += x;
+    out.push_back(
+        {r.names[p], v.size(), sum / v.size(), at(.5), at(.99), v.back()});
+  }
+  return out;
+}
+
+// a table on f; in the wasm build stdout is the browser console
+inline void report(std::FILE* f = stdout) {
+  std::fprintf(f,
+               "%-12s %8s %10s %10s %10s %10s  (us)\n",
+               "phase",
+               "count",
+               "mean",
+               "p50",
+               "p99",
+               "max");
+  for(auto const& s : summarize())
+    std::fprintf(f,
+                 "%-12s %8zu %10.2f %10.2f %10.2f %10.2f\n",
+                 s.phase.c_str(),
+                 s.count,
+                 s.mean,
+                 s.p50,
+                 s.p99,
+                 s.max);
+  std::lock_guard lock{registry().mutex};
+  for(auto const g : registry().gauges)
+    std::fprintf(f,
+                 "%-12s %8s %10.3f (last) %10.3f (max)\n",
+                 g->name,
+                 "",
+                 g->last.load(),
+                 g->max.load());
+}
+
+inline bool write_csv(char const* path) {
+  auto const f = std::fopen(path, "w");
+  if(!f) return false;
+  std::fprintf(f, "phase,count,mean_us,p50_us,p99_us,max_us\n");
+  for(auto const& s : summarize())
+    std::fprintf(f,
+                 "%s,%zu,%.3f,%.3f,%.3f,%.3f\n",
+                 s.phase.c_str(),
+                 s.count,
+                 s.mean,
+                 s.p50,
+                 s.p99,
+                 s.max);
+  {
+    std::lock_guard lock{registry().mutex};
+    for(auto const g : registry().gauges)
+      std::fprintf(
+          f, "%s,,%.3f,,,%.3f\n", g->name, g->last.load(), g->max.load());
+  }
+  return std::fclose(f) == 0;
+}
+
+} // namespace timing
@@ -0,0 +1,45 @@
+// Inspects a trajectory file written by the app (see trajectory.hpp).
+//
+//   traj file            header and frame count
+//   traj file k          frame k: step, time and every particle
+//   traj file -s step    the last frame at or before step
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string_view>
+
+#include "trajectory.hpp"
+
+int main(int argc, char** argv) try {
+  if(argc < 2) {
+    std::fprintf(stderr, "usage: %s file [k | -s step]\n", argv[0]);
+    return 1;
+  }
+  trajectory::Reader reader{argv[1]};
+  auto const& h = reader.header();
+  char const* const encodings[] = {"f32", "f16", "q16"};
+  std::printf("%" PRIu64 " particles, %g x %g world, %s, %" PRIu64
+              " frames%s\n",
+              h.particles,
+              h.world_width,
+              h.world_height,
+              encodings[static_cast<int>(h.encoding)],
+              reader.frames(),
+              h.index_offset ? "" : " (no index, unfinished?)");
+  if(argc < 3) return 0;
+  auto const k = std::string_view{argv[2]} == "-s" && argc > 3
+                     ? reader.frame_at_step(std::strtoull(argv[3], nullptr, 10))
+                     : std::strtoull(argv[2], nullptr, 10);
+  auto const f = reader.frame(k);
+  std::printf("frame %llu: step %" PRIu64 ", %g ms\n",
+              static_cast<unsigned long long>(k),
+              f.step,
+              f.time);
+  for(std::size_t i = 0; i < f.x.size(); ++i)
+    std::printf("%zu\t%g\t%g\t%g\t%g\n", i, f.x[i], f.y[i], f.vx[i], f.vy[i]);
+} catch(std::exception const& e) {
+  std::fprintf(stderr, "%s\n", e.what());
+  return 1;
+}
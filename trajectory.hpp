@@ -0,0 +1,411 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "particle_store.hpp"
+
+// Binary trajectory files: a header, then fixed-size frames of x, y, vx, vy
+// for every particle, then an index of the step number of each frame.
+// Frames all have the same size, so frame k is at a computable offset and
+// seeking is O(1); the index maps steps to frames. A file whose writer died
+// before the index was written is still readable, the frame count is then
+// taken from the file size.
+namespace trajectory {
+
+enum class Encoding : std::uint32_t {
+  f32, // exact for float simulations
+  f16, // IEEE half: 3 significant digits, coarse for positions past ~1000
+  q16, // 16 bit fixed point over the frame's position range for positions
+       // and over its [-vmax, vmax] for velocities
+};
+
+struct Header {
+  char magic[8] = {'I', 'G', 'T', 'R', 'A', 'J', '1', 0};
+  std::uint32_t version = 1;
+  Encoding encoding = Encoding::f32;
+  std::uint64_t particles = 0;
+  double world_width = 0, world_height = 0;
+  std::uint64_t frame_bytes = 0;
+  std::uint64_t frames = 0;       // filled in on close
+  std::uint64_t index_offset = 0; // filled in on close, 0 if missing
+};
+
+struct FrameHeader {
+  std::uint64_t step;
+  double time; // simulated ms
+  float vmax;  // velocity range for q16
+  // position range for q16: the world, widened to take in particles that
+  // collisions pushed past a wall
+  float x0, x1, y0, y1;
+  std::uint32_t reserved = 0;
+};
+
+inline std::size_t value_bytes(Encoding e) {
+  return e == Encoding::f32 ? 4 : 2;
+}
+
+inline std::uint64_t frame_bytes(Encoding e, std::uint64_t n) {
+  return (sizeof(FrameHeader) + 4 * n * value_bytes(e) + 7) / 8 * 8;
+}
+
+// float to IEEE half, rounding to nearest even
+inline std::uint16_t to_half(float f) {
+  auto const x = std::bit_cast<std::uint32_t>(f);
+  std::uint32_t const sign = (x >> 16) & 0x8000;
+  auto const biased = static_cast<int>((x >> 23) & 0xff);
+  std::uint32_t mant = x & 0x7fffff;
+  if(biased == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0);
+  auto const exp = biased - 127 + 15;
+  if(exp >= 31) return sign | 0x7c00;
+  auto const round = [](std::uint32_t m, int shift) {
+    auto const kept = m >> shift, rest = m & ((1u << shift) - 1);
+    auto const half = 1u << (shift - 1);
+    return kept + (rest > half || (rest == half && (kept & 1)));
+  };
+  if(exp <= 0) {
+    if(exp < -10) return sign;
+    return sign | round(mant | 0x800000, 14 - exp);
+  }
+  // a carry out of the mantissa correctly bumps the exponent
+  return sign | ((exp << 10) + round(mant, 13));
+}
+
+inline float from_half(std::uint16_t h) {
+  std::uint32_t const sign = (h & 0x8000u) << 16;
+  std::uint32_t const exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+  if(exp == 0) {
+    auto const v = mant * 0x1p-24f;
+    return sign ? -v : v;
+  }
+  if(exp == 31) return std::bit_cast<float>(sign | 0x7f800000 | (mant << 13));
+  return std::bit_cast<float>(sign | ((exp - 15 + 127) << 23) | (mant << 13));
+}
+
+inline std::uint16_t quantize(double v, double lo, double hi) {
+  auto const t = std::clamp((v - lo) / (hi - lo), 0.0, 1.0);
+  return static_cast<std::uint16_t>(std::lround(t * 65535));
+}
+inline float dequantize(std::uint16_t q, double lo, double hi) {
+  return static_cast<float>(lo + (hi - lo) * q / 65535);
+}
+
+// Appends frames to a trajectory file. write() only encodes into a frame
+// buffer; a background thread does the file I/O, one large write per frame,
+// so the caller only waits when several frames are already queued. Without
+// threads (the Emscripten build) frames are written synchronously. Once a
+// write fails, write() throws and the file is left without an index, so a
+// reader falls back to counting the whole frames in it.
+class Writer {
+ public:
+  Writer(std::string const& path,
+         Encoding encoding,
+         std::uint64_t particles,
+         double world_width,
+         double world_height)
+      : path_{path}, file_{std::fopen(path.c_str(), "wb")} {
+    if(!file_) throw std::runtime_error{"cannot open " + path};
+    header_.encoding = encoding;
+    header_.particles = particles;
+    header_.world_width = world_width;
+    header_.world_height = world_height;
+    header_.frame_bytes = frame_bytes(encoding, particles);
+    if(std::fwrite(&header_, sizeof header_, 1, file_) != 1) {
+      std::fclose(file_);
+      throw std::runtime_error{"could not write " + path};
+    }
+#ifndef __EMSCRIPTEN__
+    io_thread_ = std::thread{[this] { drain(); }};
+#endif
+  }
+  Writer(Writer const&) = delete;
+  Writer& operator=(Writer const&) = delete;
+
+  ~Writer() {
+    try {
+      close();
+    } catch(std::exception const&) {
+    }
+  }
+
+  // Flushes the queue, then writes the index and the final header; throws
+  // if any of the file could not be written.
+  void close() {
+    if(!file_) return;
+#ifndef __EMSCRIPTEN__
+    {
+      std::lock_guard lock{mutex_};
+      closing_ = true;
+    }
+    queued_.notify_one();
+    io_thread_.join();
+#endif
+    // the header only gets an index_offset if the index is all there
+    if(!failed_
+       && std::fwrite(steps_.data(), sizeof steps_[0], steps_.size(), file_)
+              == steps_.size()) {
+      header_.frames = steps_.size();
+      header_.index_offset =
+          sizeof header_ + header_.frames * header_.frame_bytes;
+      std::fseek(file_, 0, SEEK_SET);
+      if(std::fwrite(&header_, sizeof header_, 1, file_) != 1) failed_ = true;
+    } else
+      failed_ = true;
+    if(std::fclose(std::exchange(file_, nullptr)) != 0) failed_ = true;
+    if(failed_) throw std::runtime_error{"could not write " + path_};
+  }
+
+  // Particle i is stored as particle ids[i] if ids are given, so frames
+  // stay in the same order when the store is reordered.
+  template<class T>
+  void write(std::uint64_t step,
+             double time,
+             ParticleStore<T> const& p,
+             std::span<int const> ids = {}) {
+    if(p.size() != header_.particles)
+      throw std::logic_error{"trajectory: particle count changed"};
+    if(failed()) throw std::runtime_error{"could not write " + path_};
+    auto buf = take_buffer();
+    auto const x = p.x(), y = p.y(), vx = p.vx(), vy = p.vy();
+    FrameHeader fh{step,
+                   time,
+                   0,
+                   0,
+                   static_cast<float>(header_.world_width),
+                   0,
+                   static_cast<float>(header_.world_height)};
+    for(std::size_t i = 0; i < p.size(); ++i) {
+      fh.vmax =
+          std::max({fh.vmax, std::abs(float(vx[i])), std::abs(float(vy[i]))});
+      fh.x0 = std::min(fh.x0, float(x[i]));
+      fh.x1 = std::max(fh.x1, float(x[i]));
+      fh.y0 = std::min(fh.y0, float(y[i]));
+      fh.y1 = std::max(fh.y1, float(y[i]));
+    }
+    std::memcpy(buf.data(), &fh, sizeof fh);
+    double const lo[] = {fh.x0, fh.y0, -fh.vmax, -fh.vmax};
+    double const hi[] = {fh.x1, fh.y1, fh.vmax, fh.vmax};
+    auto const size = value_bytes(header_.encoding);
+    // x, y, vx and vy only
+    for(int f = 0; f < 4; ++f) {
+      auto const in = p.field(typename ParticleStore<T>::Field(f));
+      auto const out = buf.data() + sizeof fh + f * in.size() * size;
+      for(std::size_t i = 0; i < in.size(); ++i) {
+        auto const v = in[i];
+        auto const at = out + (ids.empty() ? i : ids[i]) * size;
+        switch(header_.encoding) {
+          case Encoding::f32: store(at, static_cast<float>(v)); break;
+          case Encoding::f16: store(at, to_half(static_cast<float>(v))); break;
+          case Encoding::q16: store(at, quantize(v, lo[f], hi[f])); break;
+        }
+      }
+    }
+    steps_.push_back(step);
+#ifdef __EMSCRIPTEN__
+    if(std::fwrite(buf.data(), 1, buf.size(), file_) != buf.size())
+      failed_ = true;
+    free_.push_back(std::move(buf));
+#else
+    std::lock_guard lock{mutex_};
+    queue_.push_back(std::move(buf));
+    queued_.notify_one();
+#endif
+  }
+
+ private:
+  bool failed() {
+    std::lock_guard lock{mutex_};
+    return failed_;
+  }
+
+  template<class V>
+  static void store(std::byte* out, V v) {
+    std::memcpy(out, &v, sizeof v);
+  }
+
+  // a frame buffer, waiting while max_queued frames are still being written
+  std::vector<std::byte> take_buffer() {
+    constexpr std::size_t max_queued = 3;
+    std::unique_lock lock{mutex_};
+    written_.wait(lock, [&] { return queue_.size() < max_queued; });
+    std::vector<std::byte> buf;
+    if(!free_.empty()) {
+      buf = std::move(free_.back());
+      free_.pop_back();
+    }
+    buf.assign(header_.frame_bytes, std::byte{0});
+    return buf;
+  }
+
+  void drain() {
+    std::unique_lock lock{mutex_};
+    for(;;) {
+      queued_.wait(lock, [&] { return closing_ || !queue_.empty(); });
+      if(queue_.empty()) return;
+      auto buf = std::move(queue_.front());
+      lock.unlock();
+      // after a failure the rest of the queue is dropped
+      auto const ok = !failed_ && std::fwrite(buf.data(), 1, buf.size(), file_)
+                                      == buf.size();
+      lock.lock();
+      if(!ok) failed_ = true;
+      queue_.pop_front();
+      free_.push_back(std::move(buf));
+      written_.notify_one();
+    }
+  }
+
+  std::string path_;
+  std::FILE* file_;
+  Header header_;
+  std::vector<std::uint64_t> steps_;
+
+  std::mutex mutex_;
+  std::condition_variable queued_, written_;
+  std::deque<std::vector<std::byte>> queue_;
+  std::vector<std::vector<std::byte>> free_;
+  bool closing_ = false;
+  bool failed_ = false;
+#ifndef __EMSCRIPTEN__
+  std::thread io_thread_;
+#endif
+};
+
+struct Frame {
+  std::uint64_t step = 0;
+  double time = 0;
+  std::vector<float> x, y, vx, vy;
+};
+
+class Reader {
+ public:
+  explicit Reader(std::string const& path)
+      : file_{std::fopen(path.c_str(), "rb")} {
+    if(!file_) throw std::runtime_error{"cannot open " + path};
+    auto fail = [&](std::string const& why) {
+      std::fclose(file_);
+      throw std::runtime_error{path + why};
+    };
+    if(std::fread(&header_, sizeof header_, 1, file_) != 1
+       || std::memcmp(header_.magic, Header{}.magic, sizeof header_.magic))
+      fail(" is not a trajectory file");
+    // frame_bytes must be what this encoding and particle count give, which
+    // also rules out 0
+    if(header_.version != 1 || header_.encoding > Encoding::q16
+       || header_.frame_bytes
+              != frame_bytes(header_.encoding, header_.particles))
+      fail(": unsupported trajectory");
+    if(header_.index_offset) {
+      steps_.resize(header_.frames);
+      seek(header_.index_offset);
+      if(std::fread(steps_.data(), sizeof steps_[0], steps_.size(), file_)
+         != steps_.size())
+        fail(": truncated index");
+    } else { // unfinished file: count the whole frames there are
+      std::fseek(file_, 0, SEEK_END);
+      auto const size = tell();
+      header_.frames = size < sizeof header_
+                           ? 0
+                           : (size - sizeof header_) / header_.frame_bytes;
+    }
+  }
+  Reader(Reader const&) = delete;
+  Reader& operator=(Reader const&) = delete;
+  ~Reader() { std::fclose(file_); }
+
+  Header const& header() const { return header_; }
+  std::uint64_t frames() const { return header_.frames; }
+
+  // Frame k, decoded to float. One seek and one read.
+  Frame frame(std::uint64_t k) {
+    if(k >= frames()) throw std::out_of_range{"trajectory frame"};
+    buf_.resize(header_.frame_bytes);
+    seek(sizeof header_ + k * header_.frame_bytes);
+    if(std::fread(buf_.data(), 1, buf_.size(), file_) != buf_.size())
+      throw std::runtime_error{"trajectory: short read"};
+    FrameHeader fh;
+    std::memcpy(&fh, buf_.data(), sizeof fh);
+    auto const n = header_.particles;
+    Frame out;
+    out.step = fh.step;
+    out.time = fh.time;
+    std::vector<float>* fields[] = {&out.x, &out.y, &out.vx, &out.vy};
+    double const lo[] = {fh.x0, fh.y0, -fh.vmax, -fh.vmax};
+    double const hi[] = {fh.x1, fh.y1, fh.vmax, fh.vmax};
+    std::byte const* in = buf_.data() + sizeof fh;
+    for(int f = 0; f < 4; ++f) {
+      fields[f]->resize(n);
+      for(std::uint64_t i = 0; i < n; ++i) {
+        auto& v = (*fields[f])[i];
+        switch(header_.encoding) {
+          case Encoding::f32: v = load<float>(in); break;
+          case Encoding::f16: v = from_half(load<std::uint16_t>(in)); break;
+          case Encoding::q16:
+            v = dequantize(load<std::uint16_t>(in), lo[f], hi[f]);
+            break;
+        }
+      }
+    }
+    return out;
+  }
+
+  // index of the last frame at or before step, using the index when there
+  // is one (frames are otherwise assumed evenly spaced)
+  std::uint64_t frame_at_step(std::uint64_t step) {
+    if(!frames()) return 0;
+    if(steps_.empty()) {
+      auto const first = frame(0).step;
+      auto const every =
+          frames() > 1 ? std::max<std::uint64_t>(frame(1).step - first, 1) : 1;
+      return std::min(frames() - 1, (std::max(step, first) - first) / every);
+    }
+    auto const it = std::upper_bound(steps_.begin(), steps_.end(), step);
+    return it == steps_.begin() ? 0 : it - steps_.begin() - 1;
+  }
+
+ private:
+  template<class V>
+  static V load(std::byte const*& in) {
+    V v;
+    std::memcpy(&v, in, sizeof v);
+    in += sizeof v;
+    return v;
+  }
+
+  void seek(std::uint64_t offset) {
+#ifdef _WIN32
+    _fseeki64(file_, static_cast<long long>(offset), SEEK_SET);
+#else
+    fseeko(file_, static_cast<off_t>(offset), SEEK_SET);
+#endif
+  }
+
+  std::uint64_t tell() {
+#ifdef _WIN32
+    return static_cast<std::uint64_t>(_ftelli64(file_));
+#else
+    return static_cast<std::uint64_t>(ftello(file_));
+#endif
+  }
+
+  std::FILE* file_;
+  Header header_;
+  std::vector<std::uint64_t> steps_;
+  std::vector<std::byte> buf_;
+};
+
+} // namespace trajectory
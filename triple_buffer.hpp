@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+
+// Lock-free handoff of the latest value from one producer thread to one
+// consumer thread. Each side owns one slot and the third is the latest
+// published one; publishing and acquiring swap the owned slot with it, so
+// neither side ever waits and the consumer always gets the newest value.
+template<class S>
+class TripleBuffer {
+ public:
+  // the producer's slot, to fill before publish()
+  S& back() { return slots_[back_]; }
+  void publish() {
+    back_ = latest_.exchange(back_ | fresh, std::memory_order_acq_rel) & index;
+  }
+
+  // whether something was published since the last acquire()
+  bool fresh_available() const {
+    return latest_.load(std::memory_order_acquire) & fresh;
+  }
+  // take the newest published slot as front()
+  void acquire() {
+    front_ = latest_.exchange(front_, std::memory_order_acq_rel) & index;
+  }
+  // The consumer's slot. It may be modified (e.g. swapped out) before the
+  // next acquire() hands it back to the producer.
+  S& front() { return slots_[front_]; }
+
+ private:
+  static constexpr unsigned index = 3, fresh = 4;
+  S slots_[3];
+  unsigned back_ = 0, front_ = 1;
+  std::atomic<unsigned> latest_{2};
+};